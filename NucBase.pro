@@ -8,7 +8,13 @@ QT       += core gui widgets
 
 QMAKE_CXXFLAGS +=  -s -Wall -ansi -pedantic -std=c++0x -Werror -fopenmp
 
-LIBS += -ldivsufsort -fopenmp
+LIBS += -ldivsufsort -lz -fopenmp
+
+# Zstd compressed inputs (qmake CONFIG+=zstd)
+zstd {
+    DEFINES += NUC_ZSTD
+    LIBS += -lzstd
+}
 
 TARGET = NucBase
 TEMPLATE = app
@@ -19,6 +25,12 @@ SOURCES += main.cpp\
     nucbase.cpp \
     computethread.cpp \
     nucsequences.cpp \
+    nuctable.cpp \
+    nucoutput.cpp \
+    nucinput.cpp \
+    nucautomaton.cpp \
+    nuccollapser.cpp \
+    nuctrimmer.cpp \
     convertdialog.cpp
 
 HEADERS  += \
@@ -28,6 +40,13 @@ HEADERS  += \
     mainwindow.hpp \
     nucsequences.hpp \
     nucsequences.hxx \
+    nuctable.hpp \
+    nucoutput.hpp \
+    nucinput.hpp \
+    nucautomaton.hpp \
+    nuccollapser.hpp \
+    nuctrimmer.hpp \
+    nucview.hpp \
     convertdialog.hpp
 
 FORMS    += mainwindow.ui \
@@ -0,0 +1,152 @@
+// Rank micro-benchmark : the interleaved rank blocks of NucSequence against the former
+// scheme (BWT as a byte string, _occ checkpoints every _blocksize characters, character
+// index through the std::map of Nuc::index()). Both answer the same dependent rank
+// queries (each row comes from the previous answer, as in a backward search) over the
+// BWT of a random sequence, then are checked against each other.
+//
+// Usage : rankbench [sequence size in millions of bases (64)] [queries in millions (10)]
+
+#include "nucsequences.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+using namespace std;
+
+// Block size of the former scheme
+#define MYOLDBLOCKSIZE 18
+
+
+// Access to the rank blocks of NucSequence
+struct NucRankBench : public NucSequence
+{
+  using NucSequence::buildBlocks;
+  using NucSequence::rank;
+};
+
+
+// Former scheme : _occ[ic + b*_nchar] are the occurrences of the character of index ic
+// before block b, the rest of the block is scanned in the BWT string
+class NucOldRank
+{
+  protected:
+    map<char,unsigned char> _nuc;
+    short                   _nchar;
+    string                  _bwt;
+    vector<saidx_t>         _occ;
+
+  public:
+    NucOldRank(const string & text, const saidx_t * SA, saidx_t size) : _nuc(Nuc::index()), _nchar(_nuc.size())
+    {
+      _bwt.resize(size);
+      for(saidx_t k=0; k<size; ++k)
+        _bwt[k] = SA[k] > 0 ? text[SA[k]-1] : (char)0;
+
+      saidx_t nb = size/MYOLDBLOCKSIZE;
+      _occ.assign(_nchar*(nb+1), 0);
+      for(saidx_t ind=1; ind<=nb; ++ind)
+      {
+        for(short a=0; a<_nchar; ++a)
+          _occ[a + ind*_nchar] = _occ[a + (ind-1)*_nchar];
+
+        for(short a=0; a<MYOLDBLOCKSIZE; ++a)
+          ++_occ[_nuc[_bwt[a + (ind-1)*MYOLDBLOCKSIZE]] + ind*_nchar];
+      }
+    }
+
+    inline saidx_t rank(char c, saidx_t i)
+    {
+      saidx_t b = i/MYOLDBLOCKSIZE;
+      saidx_t occ = _occ[_nuc[c] + b*_nchar];
+
+      short modb = i%MYOLDBLOCKSIZE;
+      for(short a=0; a<modb; ++a)
+        if(_bwt[a + b*MYOLDBLOCKSIZE] == c)
+          ++occ;
+      return occ;
+    }
+
+    // Bytes of the BWT and of the checkpoints
+    double memory() const { return _bwt.size() + _occ.size()*sizeof(saidx_t); }
+};
+
+
+namespace
+{
+  double seconds()
+  {
+    return (double)clock()/CLOCKS_PER_SEC;
+  }
+
+
+  // Next pseudo-random number (xorshift)
+  inline uint64_t next(uint64_t & state)
+  {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+}
+
+
+int main(int argc, char ** argv)
+{
+  saidx_t size = (saidx_t)((argc > 1 ? atof(argv[1]) : 64)*1000000);
+  long nqueries = (long)((argc > 2 ? atof(argv[2]) : 10)*1000000);
+  static const char letters[5] = { 'A', 'C', 'G', 'T', 'N' };
+
+  // Random sequence (1 N every 1000 bases), with the end character
+  uint64_t state = 88172645463325252ULL;
+  string text(size, 'A');
+  for(saidx_t k=0; k<size-1; ++k)
+    text[k] = next(state)%1000 == 0 ? 'N' : letters[next(state)%4];
+  text[size-1] = (char)0;
+
+  cout << "Suffix array of " << size << " characters..." << endl;
+  vector<saidx_t> SA(size);
+  divsufsort((const sauchar_t *)text.data(), &SA[0], size);
+
+  NucBlocks blocks;
+  saidx_t end = 0;
+  NucRankBench::buildBlocks(text, &SA[0], size, blocks, end);
+  NucOldRank old(text, &SA[0], size);
+  vector<saidx_t>().swap(SA);
+
+  cout << "Index memory (bytes per base) : " << old.memory()/size << " before, "
+       << (double)blocks.size()*sizeof(NucRankBlock)/size << " with the rank blocks" << endl;
+
+  // Each row comes from the previous answer, so the cache misses do not overlap
+  saidx_t checksum[2] = { 0, 0 };
+  double time[2];
+  for(int scheme=0; scheme<2; ++scheme)
+  {
+    uint64_t seed = 2463534242ULL;
+    saidx_t i = size/2;
+    double start = seconds();
+    for(long q=0; q<nqueries; ++q)
+    {
+      char c = letters[next(seed)%4];
+      saidx_t r = scheme == 0 ? old.rank(c, i) : NucRankBench::rank(blocks, end, c, i);
+      checksum[scheme] += r;
+      i = (saidx_t)((r*2654435761ULL + next(seed)) % (uint64_t)size);
+    }
+    time[scheme] = seconds() - start;
+  }
+
+  cout << "Dependent rank queries (ns per query) : " << 1e9*time[0]/nqueries << " before, "
+       << 1e9*time[1]/nqueries << " with the rank blocks" << endl;
+
+  // Same answers, N and the end character included
+  bool same = checksum[0] == checksum[1];
+  static const char all[6] = { 0, 'A', 'C', 'G', 'N', 'T' };
+  for(long q=0; q<nqueries/10 && same; ++q)
+  {
+    char c = all[next(state)%6];
+    saidx_t i = (saidx_t)(next(state) % ((uint64_t)size+1));
+    same = old.rank(c, i) == NucRankBench::rank(blocks, end, c, i);
+  }
+
+  cout << (same ? "Both schemes agree" : "The schemes DIFFER") << endl;
+  return same ? 0 : 1;
+}
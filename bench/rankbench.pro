@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Rank micro-benchmark (console, without Qt) :
+# qmake rankbench.pro && make && ./rankbench
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console
+CONFIG   -= app_bundle qt
+
+QMAKE_CXXFLAGS +=  -Wall -ansi -pedantic -std=c++0x -Werror -fopenmp -O2
+
+LIBS += -ldivsufsort -lz -fopenmp
+
+TARGET = rankbench
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += rankbench.cpp \
+    ../nucsequences.cpp
+
+HEADERS  += \
+    ../nucsequences.hpp \
+    ../nucsequences.hxx \
+    ../nucview.hpp
@@ -3,7 +3,8 @@
 
 ComputeThread::ComputeThread(QObject *parent) :
     QThread(parent), _db(NULL), input_ok(false),
-    _seqfolder(""), _seqname(""), _seqval(""), _mapnum(false)
+    _seqfolder(""), _seqname(""), _seqval(""), _mapnum(false), _sampling(1), _lookup(0), _concatenated(false), _bidirectional(false),
+    _gff3(true), _maxpositions(0)
 {
 }
 
@@ -143,13 +144,30 @@ void ComputeThread::run()
     NucSequences::iterator newend = unique(seqlist.begin(), seqlist.end());
     seqlist.erase(newend, seqlist.end());
 
+    // We set the suffix array sampling and the k-mer lookup tables (memory vs speed, the
+    // memory is shared by all the sequences), and the reversed index (only useful with mismatches)
+    for(NucSequences::iterator it=seqlist.begin(); it!=seqlist.end(); ++it)
+    {
+      it->sampling(_sampling);
+      it->bidirectional(_bidirectional && _mismatches > 0);
+    }
+    NucSequence::kmers(seqlist, _lookup*1048576.0);
+
+    // Without the GFF3 outputs (needed by the unmatched sequences), the hits are only counted.
+    // With them, 0 positions per read means all of them
+    _db->setGff3(_gff3 || _unmatched);
+    _db->setMaxPositions(_maxpositions > 0 ? _maxpositions : -1);
+
     _maximum = seqlist.size() * _selection.size() * _db->getNlines();
     _status = "Processing... ";
     _progress = vector<int>(1,0);
 
     try
     {
-      _db->search(seqlist,_selection,_mismatches,_submatches,_absent,_unmatched,_mapnum,_progress);
+      // The contaminant reads are left out first (one pass over the database)
+      _db->filterContaminants(_contaminants.toStdString());
+
+      _db->search(seqlist,_selection,_mismatches,_submatches,_absent,_unmatched,_mapnum,_progress,_concatenated);
     }
     catch(const ios::failure & problem1)
     {
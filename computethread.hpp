@@ -30,6 +30,13 @@ private:
   bool _absent;
   bool _unmatched;
   bool _mapnum;
+  int _sampling;
+  int _lookup;
+  bool _concatenated;
+  bool _bidirectional;
+  bool _gff3;
+  int _maxpositions;
+  QString _contaminants;
 
 protected:
   vector<int> _progress;
@@ -46,6 +53,13 @@ public:
   void setSubmatches(const int  submatches) {_submatches = submatches; }
   void setUnmatched (const bool unmatched ) {_unmatched = unmatched; }
   void setAbsent    (const bool absent    ) {_absent = absent; }
+  void setSampling  (const int  sampling  ) {_sampling = sampling; }
+  void setLookup    (const int  lookup    ) {_lookup = lookup; }
+  void setConcatenated(const bool concatenated) {_concatenated = concatenated; }
+  void setBidirectional(const bool bidirectional) {_bidirectional = bidirectional; }
+  void setGff3      (const bool gff3      ) {_gff3 = gff3; }
+  void setMaxPositions(const int maxpositions) {_maxpositions = maxpositions; }
+  void setContaminants(const QString & contaminants) {_contaminants = contaminants; }
 
   void setDB(const QString & db);
 
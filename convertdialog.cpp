@@ -18,13 +18,23 @@ ConvertDialog::~ConvertDialog()
 
 void ConvertDialog::selectFile()
 {
-  _inputpath = QFileDialog::getOpenFileName(this, tr("Open File"), "", tr("Fastq files (*.fastq *.fq);;Fasta files (*.fasta *.fa)"));
+  QStringList paths = QFileDialog::getOpenFileNames(this, tr("Open Files"), "", tr("Fastq files (*.fastq *.fq *.fastq.gz *.fq.gz *.fastq.zst *.fq.zst);;Fasta files (*.fasta *.fa *.fasta.gz *.fa.gz *.fasta.zst *.fa.zst)"));
+  if(paths.isEmpty())
+    return;
+  _inputpaths = paths;
 
-  string outputname = _inputpath.toStdString();
+  string outputname = uncompressedName(_inputpaths[0].toStdString());
   size_t extpos = outputname.rfind('.');
   QString ext = QString::fromStdString(outputname.substr(extpos+1));
   outputname.replace(extpos+1,outputname.size()-extpos,"txt");
 
+  // Several libraries give one database, next to the first one
+  if(_inputpaths.size() > 1)
+  {
+    size_t slashpos = outputname.rfind('/');
+    outputname = outputname.substr(0, slashpos+1) + "libraries.txt";
+  }
+
   ext = ext.toUpper();
   if(ext == "FASTQ" || ext == "FQ")
   {
@@ -32,6 +42,7 @@ void ConvertDialog::selectFile()
     ui->score_widget->setDisabled(false);
     ui->widget_3->setDisabled(false);
     ui->widget_5->setDisabled(false);
+    ui->umi_widget->setDisabled(false);
   }
   else
   {
@@ -39,13 +50,15 @@ void ConvertDialog::selectFile()
     ui->score_widget->setDisabled(true);
     ui->widget_3->setDisabled(true);
     ui->widget_5->setDisabled(true);
+    ui->umi_widget->setDisabled(true);
   }
 
-  if(_inputpath != 0)
-  {
-    ui->input->setText(QDir::toNativeSeparators(_inputpath));
-    ui->output->setText(QDir::toNativeSeparators(QString::fromStdString(outputname)));
-  }
+  QStringList inputs;
+  for(int i=0; i<_inputpaths.size(); ++i)
+    inputs << QDir::toNativeSeparators(_inputpaths[i]);
+  ui->input->setText(inputs.join("; "));
+  ui->output->setText(QDir::toNativeSeparators(QString::fromStdString(outputname)));
+  _outputpath = QString::fromStdString(outputname);
 }
 
 
@@ -57,11 +70,23 @@ void ConvertDialog::convert()
   int score = ui->score->value();
   int minsize = ui->minSize->value();
   int maxsize = ui->maxSize->value();
+  int umisize = ui->umiSize->value();
+  int umioffset = ui->umiOffset->value();
+
+  if(_inputpaths.isEmpty())
+    return;
 
-  if(_fastq)
-    fastq2txt(_inputpath.toStdString(),adapter3,adapter5,encoding,minsize,maxsize,score);
+  if(_inputpaths.size() > 1)
+  {
+    vector<string> inputnames;
+    for(int i=0; i<_inputpaths.size(); ++i)
+      inputnames.push_back(_inputpaths[i].toStdString());
+    libraries2txt(inputnames,_outputpath.toStdString(),_fastq,adapter3,adapter5,encoding,minsize,maxsize,score,umisize,umioffset);
+  }
+  else if(_fastq)
+    fastq2txt(_inputpaths[0].toStdString(),adapter3,adapter5,encoding,minsize,maxsize,score,umisize,umioffset);
   else
-    fasta2txt(_inputpath.toStdString(),adapter3,adapter5,minsize,maxsize);
+    fasta2txt(_inputpaths[0].toStdString(),adapter3,adapter5,minsize,maxsize);
 
   this->close();
 }
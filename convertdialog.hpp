@@ -4,6 +4,7 @@
 #include <QDialog>
 #include <QThread>
 #include <QString>
+#include <QStringList>
 
 namespace Ui {
 class ConvertDialog;
@@ -19,7 +20,8 @@ class ConvertDialog : public QDialog
     
   private:
     Ui::ConvertDialog *ui;
-    QString _inputpath;
+    QStringList _inputpaths;
+    QString _outputpath;
     bool _fastq;
 
   private slots:
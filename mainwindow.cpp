@@ -124,6 +124,15 @@ void MainWindow::selectSequenceFile()
   }
 }
 
+void MainWindow::selectContaminants()
+{
+  // Cancelling the dialog removes the filter
+  QString path = QFileDialog::getOpenFileName(this, tr("Open File"), "", tr("Sequence files (*.txt *.fa *.fasta)"));
+  _worker.setContaminants(path);
+
+  _ui->contaminants_lineEdit->setText(QDir::toNativeSeparators(path));
+}
+
 void MainWindow::setSequenceName()
 {
   QString seqname = _ui->input_name->text();
@@ -165,9 +174,15 @@ void MainWindow::start()
   // We set the search parameters
   _worker.setMismatches(_ui->mismatches_spinBox->value());
   _worker.setSubmatches(_ui->submatches_spinBox->value());
+  _worker.setSampling(_ui->sampling_spinBox->value());
+  _worker.setLookup(_ui->lookup_spinBox->value());
   _worker.setMapnum(_ui->mapnum_checkBox->isChecked());
   _worker.setAbsent(_ui->absent_checkBox->isChecked());
   _worker.setUnmatched(_ui->unmatched_checkBox->isChecked());
+  _worker.setConcatenated(_ui->concatenated_checkBox->isChecked());
+  _worker.setBidirectional(_ui->bidirectional_checkBox->isChecked());
+  _worker.setGff3(_ui->gff3_checkBox->isChecked());
+  _worker.setMaxPositions(_ui->positions_spinBox->value());
 
   // We start the worker thread and the timer
   _timer.start(100);
@@ -30,6 +30,7 @@ private slots:
   void setDatabaseSelection();
   void selectSequencesFolder();
   void selectSequenceFile();
+  void selectContaminants();
   void setSequenceName();
   void setSequenceValue();
   void setFolderMode(bool val);
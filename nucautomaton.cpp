@@ -0,0 +1,111 @@
+#include "nucautomaton.hpp"
+using namespace std;
+
+
+NucAutomaton::NucAutomaton(uint32_t npatterns) :
+  _next(4, 0), _output(1, MYNOPATTERN), _dict(1, 0), _same(npatterns, MYNOPATTERN), _sizes(npatterns, 0)
+{
+}
+
+
+bool NucAutomaton::add(uint32_t id, const NucView & word)
+{
+  // We check the word first, so that nothing is added if it can't be matched
+  if(word.empty())
+    return false;
+  for(size_t i=0; i<word.size(); ++i)
+    if(letter(word[i]) < 0)
+      return false;
+
+  // We follow the trie, and create the missing nodes (0 is the root, never a child)
+  uint32_t node = 0;
+  for(size_t i=0; i<word.size(); ++i)
+  {
+    uint32_t & child = _next[4*node + letter(word[i])];
+    if(child == 0)
+    {
+      child = _output.size();
+      _next.resize(_next.size()+4, 0);
+      _output.push_back(MYNOPATTERN);
+      _dict.push_back(0);
+    }
+    node = _next[4*node + letter(word[i])];
+  }
+
+  // The word is added to the ones ending at this node
+  _sizes[id] = word.size();
+  _same[id] = _output[node];
+  _output[node] = id;
+
+  return true;
+}
+
+
+void NucAutomaton::build()
+{
+  // Breadth-first : the failure of a node is known before its children
+  vector<uint32_t> fail(_output.size(), 0);
+  vector<uint32_t> queue;
+  queue.reserve(_output.size());
+  queue.push_back(0);
+
+  for(size_t k=0; k<queue.size(); ++k)
+  {
+    uint32_t node = queue[k];
+    for(int c=0; c<4; ++c)
+    {
+      uint32_t child = _next[4*node + c];
+      uint32_t next = node == 0 ? 0 : _next[4*fail[node] + c];
+
+      if(child == 0)
+      {
+        // Missing transition : same as the one of the failure
+        _next[4*node + c] = next;
+        continue;
+      }
+
+      fail[child] = next;
+      _dict[child] = _output[next] != MYNOPATTERN ? next : _dict[next];
+      queue.push_back(child);
+    }
+  }
+}
+
+
+void NucAutomaton::scan(const string & text)
+{
+  // Occurrences in the text order (word, start position)
+  vector<pair<uint32_t, saidx_t> > hits;
+
+  uint32_t node = 0;
+  saidx_t size = text.size();
+  for(saidx_t i=0; i<size; ++i)
+  {
+    int c = letter(text[i]);
+    if(c < 0)
+    {
+      node = 0;
+      continue;
+    }
+
+    node = _next[4*node + c];
+
+    // Words ending here : at this node, then at its suffixes
+    for(uint32_t u = _output[node] != MYNOPATTERN ? node : _dict[node]; u != 0; u = _dict[u])
+      for(uint32_t id = _output[u]; id != MYNOPATTERN; id = _same[id])
+        hits.push_back(make_pair(id, i+1-(saidx_t)_sizes[id]));
+  }
+
+  // We group them by word (counting sort, the order of the positions is kept)
+  uint32_t npatterns = _sizes.size();
+  _first.assign(npatterns+1, 0);
+  for(size_t k=0; k<hits.size(); ++k)
+    ++_first[hits[k].first+1];
+  for(uint32_t id=0; id<npatterns; ++id)
+    _first[id+1] += _first[id];
+
+  vector<saidx_t> filled(_first.begin(), _first.end()-1);
+  _positions.resize(hits.size()+1);
+  for(size_t k=0; k<hits.size(); ++k)
+    _positions[filled[hits[k].first]++] = hits[k].second;
+}
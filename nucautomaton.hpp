@@ -0,0 +1,67 @@
+#ifndef NUCAUTOMATON_HPP
+#define NUCAUTOMATON_HPP
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <divsufsort.h>
+#include "nucview.hpp"
+using namespace std;
+
+// No pattern ending at a node (or after a pattern with the same word)
+#define MYNOPATTERN 0xFFFFFFFFu
+
+
+// Aho-Corasick automaton over words of A, C, G and T : a sequence is scanned once
+// and every occurrence of every word is reported. The words are identified by the
+// caller (ids below the number given to the constructor), identical words share
+// their node. Characters other than A, C, G and T in the text match no word.
+class NucAutomaton
+{
+  protected:
+    vector<uint32_t> _next;   // 4 transitions per node (complete once built)
+    vector<uint32_t> _output; // First word ending at each node
+    vector<uint32_t> _dict;   // Nearest proper suffix with a word ending at it (0 = none)
+    vector<uint32_t> _same;   // Next word ending at the same node
+    vector<uint32_t> _sizes;  // Size of each word
+
+    // Occurrences of the last scanned text, grouped by word (in increasing positions)
+    vector<saidx_t>  _first;
+    vector<saidx_t>  _positions;
+
+    // Transition letter of a character (-1 if it is not A, C, G or T)
+    static inline int letter(char c)
+    {
+      switch(c)
+      {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default : return -1;
+      }
+    }
+
+  public:
+    // Constructor (ids of the words below npatterns)
+    NucAutomaton(uint32_t npatterns);
+
+    // Memory of an automaton over words of this many characters at most (one node per
+    // character : transitions, output and suffix link), in bytes
+    static double memory(double characters) { return characters*6*sizeof(uint32_t); }
+
+    // Adds a word (false, and nothing added, if it has other characters than A, C, G and T)
+    bool add(uint32_t id, const NucView & word);
+
+    // Failure transitions, once all the words are added
+    void build();
+
+    // Finds all the occurrences in a text
+    void scan(const string & text);
+
+    // Occurrences of a word in the last scanned text
+    const saidx_t * begin(uint32_t id) const { return &_positions[0] + _first[id];   }
+    const saidx_t * end(uint32_t id)   const { return &_positions[0] + _first[id+1]; }
+};
+
+#endif // NUCAUTOMATON_HPP
@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <algorithm>
 #include <cstdlib>
+#include <cstdio>
 #include <iostream>
 #include <sstream>
 #include <map>
@@ -19,225 +20,503 @@ using namespace std;
 #endif
 
 // Utility functions
-void fastq2txt(string inputname, string & adapter3, string & adapter5, fq_encoding encoding, int minsize, int maxsize, int score)
+namespace
 {
-  map<string, int> data;
-  char base_score = 33;
-  bool nomaxsize = (maxsize == 0);
-  bool ad3 = !adapter3.empty();
-  bool ad5 = !adapter5.empty();
+  // Next line of a file read by blocks, [begin,end) without the newline : false if the
+  // line is not complete yet (more of the file is needed) or if there is no more line
+  bool nextLine(const string & block, size_t & pos, bool eof, size_t & begin, size_t & end)
+  {
+    if(pos >= block.size())
+      return false;
 
-  switch(encoding)
+    size_t newline = block.find('\n', pos);
+    if(newline == string::npos)
+    {
+      if(!eof)
+        return false;
+      newline = block.size();
+    }
+
+    begin = pos;
+    end = newline;
+    pos = min(newline+1, block.size());
+    return true;
+  }
+
+  // Same as string::find, in a view
+  size_t find(const NucView & text, const char * pattern, size_t size)
   {
-    case SANGER : base_score = 33; break;
-    case SOLEXA : base_score = 59; break;
-    case IL13 : base_score = 64; break;
-    case IL15 : base_score = 64; break;
-    case IL18 : base_score = 33; break;
+    const char * end = text.data()+text.size();
+    const char * it = search(text.data(), end, pattern, pattern+size);
+    return (it == end && size > 0) ? string::npos : it-text.data();
   }
 
-  string outputname = inputname;
-  size_t extpos = outputname.rfind('.');
-  size_t slashpos = outputname.rfind('/');
-  outputname.replace(extpos+1,outputname.size()-extpos,"txt");
+  // Number of threads of the converters
+  int convertThreads()
+  {
+    int numthreads = 1;
+    #ifdef _OPENMP
+    numthreads = max(omp_get_max_threads(), 1);
+    #endif
+    return numthreads;
+  }
 
-  ifstream fastq(inputname.c_str());
-  if(fastq.is_open())
+  // Output name (.txt) and label of a library (name of its file, without the extensions)
+  void libraryNames(const string & inputname, string & outputname, string & label)
   {
-    string line;
-    while(getline(fastq,line))
+    outputname = uncompressedName(inputname);
+    size_t extpos = outputname.rfind('.');
+    size_t slashpos = outputname.rfind('/');
+    label = outputname.substr(slashpos+1, extpos-slashpos-1);
+    outputname.replace(extpos+1,outputname.size()-extpos,"txt");
+  }
+
+  // Counts the distinct reads of a fastq file (false if it can't be opened)
+  bool countFastq(const string & inputname, NucCollapser & data, const string & adapter3, const string & adapter5,
+                  fq_encoding encoding, int minsize, int maxsize, int score, int umisize, int umioffset)
+  {
+    char base_score = 33;
+    bool nomaxsize = (maxsize == 0);
+    bool ad3 = !adapter3.empty();
+    bool ad5 = !adapter5.empty();
+    bool umis = ad3 && umisize > 0;
+
+    switch(encoding)
+    {
+      case SANGER : base_score = 33; break;
+      case SOLEXA : base_score = 59; break;
+      case IL13 : base_score = 64; break;
+      case IL15 : base_score = 64; break;
+      case IL18 : base_score = 33; break;
+    }
+
+    // The file is read (and decompressed) by a background thread
+    NucReader fastq(inputname, MYCONVERTBLOCK);
+    if(!fastq.is_open())
+      return false;
+
+    // The distinct reads are counted in hash tables, filled in parallel
+    int numthreads = convertThreads();
+    vector<NucReadBatch> batches(numthreads);
+    NucTrimmer trimmer(adapter3);
+
+    // The file is read by blocks : the records are found by one thread (only the
+    // line starts are read), then they are trimmed and packed in parallel
+    string block;
+    vector<size_t> records; // Sequence and scores lines of each record (begin, end, begin, end)
+    bool eof = false;
+
+    while(!eof)
     {
-      string seqid;
-      string seq;
-      string scores;
-      char minscore;
+      eof = !fastq.read(block);
+      if(eof && fastq.failed())
+        throw ios::failure( "Error while reading the fastq file !" );
+
+      records.clear();
+      size_t pos = 0;
+      size_t done = 0; // End of the last complete record
+      size_t begin, end;
+      while(nextLine(block, pos, eof, begin, end))
+      {
+        if(block[begin] != '@')
+        {
+          done = pos;
+          continue;
+        }
+
+        size_t seqbegin, seqend, scoresbegin, scoresend;
+        if(!nextLine(block, pos, eof, seqbegin, seqend))
+        {
+          if(eof)
+            throw ios::failure( "Error while reading the fastq file ! (2)" );
+          break;
+        }
+
+        if(!nextLine(block, pos, eof, begin, end))
+        {
+          if(eof)
+            throw ios::failure( "Error while reading the fastq file ! (3)" );
+          break;
+        }
+        if(block[begin] != '+')
+          throw ios::failure( "Error while reading the fastq file ! (3)" );
+
+        if(!nextLine(block, pos, eof, scoresbegin, scoresend))
+        {
+          if(eof)
+            throw ios::failure( "Error while reading the fastq file ! (4)" );
+          break;
+        }
+
+        records.push_back(seqbegin);
+        records.push_back(seqend);
+        records.push_back(scoresbegin);
+        records.push_back(scoresend);
+        done = pos;
+      }
+
+      int nrecords = records.size()/4;
 
-      if(line[0] == '@')
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static) num_threads(numthreads)
+      #endif
+      for(int r=0; r<nrecords; ++r)
       {
-        seqid = line.substr(1);
-        if(getline(fastq,line))
+        int thread = 0;
+
+        #ifdef _OPENMP
+        thread = omp_get_thread_num();
+        #endif
+
+        // Views of the record in the block (the trimming does not copy them)
+        NucView seq(block.data()+records[4*r], records[4*r+1]-records[4*r]);
+        NucView scores(block.data()+records[4*r+2], records[4*r+3]-records[4*r+2]);
+        char minscore;
+
+        // (the reads without the 5' adapter are kept as they are)
+        if(ad5)
         {
-          seq = line;
-          if(getline(fastq,line) && line[0] == '+')
+          size_t ad5pos = find(seq, adapter5.data(), adapter5.size());
+          if(ad5pos != string::npos)
           {
-            if(getline(fastq,line))
-            {
-              scores = line;
-
-              if(ad5)
-              {
-                size_t ad5pos = seq.find(adapter5);
-                scores = scores.substr(ad5pos);
-                seq = seq.substr(ad5pos);
-              }
-
-              if(ad3)
-              {
-                size_t ad3pos = 0;
-                size_t size = adapter3.size();
-                do
-                {
-                  ad3pos = seq.find(adapter3.substr(0,size));
-                  --size;
-                } while(ad3pos == string::npos && size >= 8);
-
-                if(size == 8 || ad3pos == string::npos)
-                {
-                  int mm = 0;
-                  size = adapter3.size();
-                  ad3pos = seq.find(adapter3.substr(0,5));
-                  if(ad3pos != string::npos)
-                  {
-                    for(size_t i=5; i<size; ++i)
-                      if(seq[ad3pos+i] != adapter3[i])
-                        ++mm;
-
-                    if( (float)mm/(float)(size-5) < 0.2 )
-                    {
-                      scores = scores.substr(0,ad3pos);
-                      seq = seq.substr(0,ad3pos);
-                    }
-                  }
-                }
-                else
-                {
-                  scores = scores.substr(0,ad3pos);
-                  seq = seq.substr(0,ad3pos);
-                }
-              }
-
-              if(encoding == IL15)
-              {
-                size_t posB = scores.find('B');
-                scores = scores.substr(0, posB);
-                seq = seq.substr(0, posB);
-              }
-            }
-            else
-              throw ios::failure( "Error while reading the fastq file ! (4)" );
+            scores = scores.substr(min(ad5pos, scores.size()), string::npos);
+            seq = seq.substr(ad5pos, string::npos);
           }
-          else
-            throw ios::failure( "Error while reading the fastq file ! (3)" );
         }
-        else
-          throw ios::failure( "Error while reading the fastq file ! (2)" );
+
+        // (the UMI follows the 3' adapter, the reads without it are left out)
+        NucView umi;
+        if(ad3)
+        {
+          size_t ad3pos = trimmer.find(seq);
+          if(ad3pos != string::npos)
+          {
+            size_t umipos = ad3pos + adapter3.size() + umioffset;
+            if(umis && umipos + umisize <= seq.size())
+              umi = seq.substr(umipos, umisize);
+
+            scores = scores.substr(0,ad3pos);
+            seq = seq.substr(0,ad3pos);
+          }
+        }
+
+        if(encoding == IL15)
+        {
+          size_t posB = find(scores, "B", 1);
+          scores = scores.substr(0, posB);
+          seq = seq.substr(0, posB);
+        }
 
         minscore = (char)127;
-        for(string::iterator it=scores.begin(); it != scores.end(); ++it)
-          if(minscore > *it)
-            minscore = *it;
+        for(size_t i=0; i<scores.size(); ++i)
+          if(minscore > scores[i])
+            minscore = scores[i];
 
         if((int)(minscore-base_score) >= score)
           if(nomaxsize || (size_t)maxsize >= seq.size())
             if((size_t)minsize <= seq.size())
-              data[seq]++;
+            {
+              if(!umis)
+                batches[thread].add(seq);
+              else if(!umi.empty())
+                batches[thread].add(seq, umi);
+            }
       }
-    }
-    fastq.close();
-
-    ofstream txt(outputname.c_str());
-    if(txt.is_open())
-    {
-      txt << "labels\t" << inputname.substr(slashpos+1, extpos-slashpos-1) << endl;
 
-      for(map<string,int>::iterator it=data.begin(); it!=data.end(); ++it)
-        txt << it->first << "\t" << it->second << endl;
-
-      txt.close();
+      // The views are counted before the next block replaces them
+      data.count(batches);
+      block.erase(0, done);
     }
-  }
-  else
-    throw ios::failure( "Error while reading the fastq file !" );
 
-}
+    return true;
+  }
 
-void fasta2txt(string inputname, string & adapter3, string & adapter5, int minsize, int maxsize)
-{
-  map<string, int> data;
-  bool nomaxsize = (maxsize == 0);
-  bool ad3 = !adapter3.empty();
-  bool ad5 = !adapter5.empty();
-
-  string outputname = inputname;
-  size_t extpos = outputname.rfind('.');
-  size_t slashpos = outputname.rfind('/');
-  outputname.replace(extpos+1,outputname.size()-extpos,"txt");
-
-  ifstream fasta(inputname.c_str());
-  if(fasta.is_open())
+  // Counts the distinct reads of a fasta file (false if it can't be opened)
+  bool countFasta(const string & inputname, NucCollapser & data, const string & adapter3, const string & adapter5,
+                  int minsize, int maxsize)
   {
-    string line;
-    string seqname;
-    string seq = "";
-    while(getline(fasta,line))
+    bool nomaxsize = (maxsize == 0);
+    bool ad3 = !adapter3.empty();
+    bool ad5 = !adapter5.empty();
+
+    // The file is read (and decompressed) by a background thread
+    NucReader fasta(inputname, MYCONVERTBLOCK);
+    if(!fasta.is_open())
+      return false;
+
+    // The distinct reads are counted in hash tables, filled in parallel
+    int numthreads = convertThreads();
+    vector<NucReadBatch> batches(numthreads);
+    NucTrimmer trimmer(adapter3, false);
+    vector<string> seqs(numthreads);
+
+    // The file is read by blocks : a read is made of the lines before each name
+    // (found by one thread), then they are joined, trimmed and packed in parallel
+    string block;
+    vector<size_t> records; // Lines of each read (begin, end)
+    bool eof = false;
+
+    while(!eof)
     {
-      if(line[0] == '>')
+      eof = !fasta.read(block);
+      if(eof && fasta.failed())
+        throw ios::failure( "Error while reading the fasta file !" );
+
+      records.clear();
+      size_t pos = 0;
+      size_t done = 0; // Start of the lines of the next read
+      size_t begin, end;
+      while(nextLine(block, pos, eof, begin, end))
       {
+        if(block[begin] == '>')
+        {
+          records.push_back(done);
+          records.push_back(begin);
+          done = pos;
+        }
+      }
+
+      int nrecords = records.size()/2;
+
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static) num_threads(numthreads)
+      #endif
+      for(int r=0; r<nrecords; ++r)
+      {
+        int thread = 0;
+
+        #ifdef _OPENMP
+        thread = omp_get_thread_num();
+        #endif
+
+        // We join the lines of the read
+        string & seq = seqs[thread];
+        seq.clear();
+        for(size_t i=records[2*r]; i<records[2*r+1]; ++i)
+          if(block[i] != '\n')
+            seq.push_back(block[i]);
+
+        // (the reads without the 5' adapter are kept as they are)
         if(ad5)
-          seq = seq.substr(seq.find(adapter5));
+        {
+          size_t ad5pos = seq.find(adapter5);
+          if(ad5pos != string::npos)
+            seq.erase(0, ad5pos);
+        }
 
         if(ad3)
         {
-          size_t ad3pos;
-          size_t size = adapter3.size();
-          do
-          {
-            ad3pos = seq.find(adapter3.substr(0,size));
-            --size;
-          } while(ad3pos == string::npos && size >= 8);
-
-          if(size == 8 || ad3pos == string::npos)
-          {
-            int mm = 0;
-            size = adapter3.size();
-            ad3pos = seq.find(adapter3.substr(0,5));
-            if(ad3pos != string::npos)
-            {
-              for(size_t i=5; i<size; ++i)
-                if(seq[ad3pos+i] != adapter3[i])
-                  ++mm;
-
-              if( (float)mm/(float)(size-5) < 0.2 )
-                seq = seq.substr(0,ad3pos);
-            }
-            else
-              seq = seq.substr(0,ad3pos);
-          }
+          size_t ad3pos = trimmer.find(seq);
+          if(ad3pos != string::npos)
+            seq.resize(ad3pos);
         }
 
         if(nomaxsize || (size_t)maxsize >= seq.size())
           if((size_t)minsize <= seq.size())
-            data[seq]++;
+            batches[thread].add(seq);
+      }
+
+      // The reads are counted before the next block replaces them
+      data.count(batches);
+      block.erase(0, done);
+    }
+
+    return true;
+  }
+
+  // Sorted tables of the libraries ("read\tcount" lines), merged by their next read
+  struct NucRuns
+  {
+    vector<string> lines; // Current line of each table
+    vector<size_t> tabs;  // End of its read
 
-        seq = "";
-        seqname = line.substr(1);
+    bool operator()(int a, int b) const
+    {
+      return lines[a].compare(0, tabs[a], lines[b], 0, tabs[b]) > 0;
+    }
+  };
+
+  // Writes the database of the sorted tables (one column per table, 0 if a read is missing),
+  // only the current line of each table is kept in memory
+  void mergeRuns(vector<ifstream*> & runs, ostream & out)
+  {
+    int nruns = runs.size();
+    NucRuns current;
+    current.lines.resize(nruns);
+    current.tabs.resize(nruns);
+
+    // Heap of the tables by their next read (the smallest on top)
+    vector<int> heap;
+    for(int r=0; r<nruns; ++r)
+      if(getline(*runs[r], current.lines[r]))
+      {
+        current.tabs[r] = current.lines[r].find('\t');
+        heap.push_back(r);
+      }
+    make_heap(heap.begin(), heap.end(), current);
+
+    string buffer;
+    vector<int> row;
+    vector<int> counts(nruns, -1); // Table of each column of the row (-1 if the read is missing)
+    while(!heap.empty())
+    {
+      // We take the tables with the same read
+      row.clear();
+      do
+      {
+        pop_heap(heap.begin(), heap.end(), current);
+        row.push_back(heap.back());
+        heap.pop_back();
+      } while(!heap.empty() && !current(heap.front(), row[0]) && !current(row[0], heap.front()));
+
+      const string & first = current.lines[row[0]];
+      buffer.append(first, 0, current.tabs[row[0]]);
+      for(size_t i=0; i<row.size(); ++i)
+        counts[row[i]] = row[i];
+
+      for(int r=0; r<nruns; ++r)
+      {
+        buffer.push_back('\t');
+        if(counts[r] < 0)
+          buffer.push_back('0');
+        else
+          buffer.append(current.lines[r], current.tabs[r]+1, string::npos);
+      }
+      buffer.push_back('\n');
+
+      if(buffer.size() >= 1048576)
+      {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+      }
+
+      // Then their next reads
+      for(size_t i=0; i<row.size(); ++i)
+      {
+        int r = row[i];
+        counts[r] = -1;
+        if(getline(*runs[r], current.lines[r]))
+        {
+          current.tabs[r] = current.lines[r].find('\t');
+          heap.push_back(r);
+          push_heap(heap.begin(), heap.end(), current);
+        }
       }
-      else
-        seq += line;
     }
-    fasta.close();
 
+    out.write(buffer.data(), buffer.size());
+  }
+}
+
+
+void fastq2txt(string inputname, string & adapter3, string & adapter5, fq_encoding encoding, int minsize, int maxsize, int score, int umisize, int umioffset)
+{
+  string outputname, label;
+  libraryNames(inputname, outputname, label);
+
+  NucCollapser data;
+  if(!countFastq(inputname, data, adapter3, adapter5, encoding, minsize, maxsize, score, umisize, umioffset))
+    throw ios::failure( "Error while reading the fastq file !" );
+
+  ofstream txt(outputname.c_str());
+  if(txt.is_open())
+  {
+    txt << "labels\t" << label << endl;
+    data.write(txt);
+    txt.close();
+  }
+}
+
+void fasta2txt(string inputname, string & adapter3, string & adapter5, int minsize, int maxsize)
+{
+  string outputname, label;
+  libraryNames(inputname, outputname, label);
+
+  NucCollapser data;
+  if(countFasta(inputname, data, adapter3, adapter5, minsize, maxsize))
+  {
     ofstream txt(outputname.c_str());
     if(txt.is_open())
     {
-      txt << "labels\t" << inputname.substr(slashpos+1, extpos-slashpos-1) << endl;
+      txt << "labels\t" << label << endl;
+      data.write(txt);
+      txt.close();
+    }
+  }
+}
+
+void libraries2txt(const vector<string> & inputnames, const string & outputname, bool fastq,
+                   string & adapter3, string & adapter5, fq_encoding encoding, int minsize, int maxsize, int score,
+                   int umisize, int umioffset)
+{
+  int nlibraries = inputnames.size();
+  vector<string> labels(nlibraries);
+  vector<string> runnames;
+
+  try
+  {
+    // Each library is counted (all the threads on it), then its sorted table is written
+    // to a temporary file : one library at a time is kept in memory
+    for(int l=0; l<nlibraries; ++l)
+    {
+      string name;
+      libraryNames(inputnames[l], name, labels[l]);
+
+      NucCollapser data;
+      bool ok = fastq ? countFastq(inputnames[l], data, adapter3, adapter5, encoding, minsize, maxsize, score, umisize, umioffset)
+                      : countFasta(inputnames[l], data, adapter3, adapter5, minsize, maxsize);
+      if(!ok)
+        throw ios::failure( "Error while reading the file " + inputnames[l] + " !" );
+
+      ostringstream runname;
+      runname << outputname << "." << l << ".tmp";
+      runnames.push_back(runname.str());
+
+      ofstream run(runnames.back().c_str());
+      data.write(run);
+      run.close();
+      if(run.fail())
+        throw ios::failure( "Error while writing " + runnames.back() + " !" );
+    }
 
-      for(map<string,int>::iterator it=data.begin(); it!=data.end(); ++it)
-        txt << it->first << "\t" << it->second << endl;
+    // Then the tables are merged, line by line
+    vector<ifstream*> runs;
+    for(int l=0; l<nlibraries; ++l)
+      runs.push_back(new ifstream(runnames[l].c_str()));
 
+    ofstream txt(outputname.c_str());
+    if(txt.is_open())
+    {
+      txt << "labels";
+      for(int l=0; l<nlibraries; ++l)
+        txt << "\t" << labels[l];
+      txt << endl;
+
+      mergeRuns(runs, txt);
       txt.close();
     }
+
+    for(int l=0; l<nlibraries; ++l)
+      delete runs[l];
+  }
+  catch(...)
+  {
+    for(size_t r=0; r<runnames.size(); ++r)
+      remove(runnames[r].c_str());
+    throw;
   }
+
+  for(size_t r=0; r<runnames.size(); ++r)
+    remove(runnames[r].c_str());
 }
 
+
 NucBase::NucBase( string inputname, string outputfolder ) : 
   _inputname(inputname), _dataname("data"), _outputfolder(outputfolder),
   _labelled(false), _colmapnum(0), _colname(0),
-  _nlines(1), _maxsize(0)
+  _nlines(1), _maxsize(0), _gff3(true), _maxpositions(-1)
 {
   bool invalid = false;
-  bool consensus = false;
-  string cons_char = "UKSYMWRBDHVN";
   string accepted_chars = "ACGTUKSYMWRBDHVN";
 
   // We give the database a name
@@ -261,7 +540,6 @@ NucBase::NucBase( string inputname, string outputfolder ) :
       vector<string> words;
       string line;
       string word;
-      size_t found;
       size_t bad_char;
 
       // We parse the first line
@@ -279,9 +557,6 @@ NucBase::NucBase( string inputname, string outputfolder ) :
       // We check that we have at least 1 column
       if(nbcol > 0)
       {
-        // We save the first word for later
-        word = words[0];
-
         // We convert the first line words to lower case
         for(int i=0; i<nbcol; ++i)
           std::transform(words[i].begin(), words[i].end(), words[i].begin(), (int (*)(int))tolower);
@@ -295,9 +570,6 @@ NucBase::NucBase( string inputname, string outputfolder ) :
           {
             _labels = words;
 
-            // We don't count the first line
-            _nlines--;
-
             for(int i=0; i<nbcol; ++i)
               if(words[i] == "mapnum")
                 _colmapnum = i;
@@ -328,52 +600,32 @@ NucBase::NucBase( string inputname, string outputfolder ) :
 
             _labels.push_back(_dataname);
           }
+        }
 
-          // We check if the string is valid
-          bad_char = word.find_first_not_of(accepted_chars);
-          invalid |= bad_char != string::npos;
+        // We close the file
+        input.close();
 
-          // We check for special notation characters in the first line
-          found = word.find_first_of(cons_char);
-          consensus |= found != string::npos;
+        // We load the whole database in memory, once
+        _table.load(_inputname, _labelled);
+        _nlines = _table.rows();
 
-          // We look for the largest read
-          if(_maxsize < (int)word.size())
-            _maxsize = (int)word.size();
-        }
-
-        // We count the number of lines (and keep checking)
-        while(getline(input, line) && !invalid)
+        // We check the reads
+        for(int l=0; l<_nlines && !invalid; ++l)
         {
-          ++_nlines;
-
-          stringstream strstr(line);
-          getline(strstr, word, '\t');
+          word.assign(_table.read(l), _table.readsize(l));
 
           // We check if the word is valid
           bad_char = word.find_first_not_of(accepted_chars);
           invalid |= bad_char != string::npos;
 
-          // We look for degenerate bases
-          size_t tab = line.find('\t');
-          found = line.find_first_of(cons_char);
-
           // We look for the largest read
           if(_maxsize < (int)word.size())
             _maxsize = (int)word.size();
-
-          if(!consensus)
-            consensus = found < tab;
         }
 
-        // We close the file
-        input.close();
-
+        // The degenerate bases (IUPAC codes) are matched by the searches, the reads are kept as they are
         if(invalid)
           throw invalid_argument("Invalid characters in the database.");
-        else
-          if(consensus)
-            expand();
       }
       else
         invalid = true;
@@ -387,143 +639,7 @@ NucBase::NucBase( string inputname, string outputfolder ) :
 }
 
 
-void NucBase::expand()
-{
-  string cons_char = "UKSYMWRBDHVN";
-
-  // Map
-  typedef multimap<char, char> MyMap;
-  MyMap mapping;
-  mapping.insert(pair<char,char>('A','A'));
-  mapping.insert(pair<char,char>('C','C'));
-  mapping.insert(pair<char,char>('G','G'));
-  mapping.insert(pair<char,char>('T','T'));
-  mapping.insert(pair<char,char>('U','T'));
-  mapping.insert(pair<char,char>('K','G'));
-  mapping.insert(pair<char,char>('K','T'));
-  mapping.insert(pair<char,char>('S','G'));
-  mapping.insert(pair<char,char>('S','C'));
-  mapping.insert(pair<char,char>('Y','C'));
-  mapping.insert(pair<char,char>('Y','T'));
-  mapping.insert(pair<char,char>('M','A'));
-  mapping.insert(pair<char,char>('M','C'));
-  mapping.insert(pair<char,char>('W','A'));
-  mapping.insert(pair<char,char>('W','T'));
-  mapping.insert(pair<char,char>('R','A'));
-  mapping.insert(pair<char,char>('R','G'));
-  mapping.insert(pair<char,char>('B','C'));
-  mapping.insert(pair<char,char>('B','G'));
-  mapping.insert(pair<char,char>('B','T'));
-  mapping.insert(pair<char,char>('D','A'));
-  mapping.insert(pair<char,char>('D','G'));
-  mapping.insert(pair<char,char>('D','T'));
-  mapping.insert(pair<char,char>('H','A'));
-  mapping.insert(pair<char,char>('H','C'));
-  mapping.insert(pair<char,char>('H','T'));
-  mapping.insert(pair<char,char>('V','A'));
-  mapping.insert(pair<char,char>('V','C'));
-  mapping.insert(pair<char,char>('V','G'));
-  mapping.insert(pair<char,char>('N','A'));
-  mapping.insert(pair<char,char>('N','C'));
-  mapping.insert(pair<char,char>('N','G'));
-  mapping.insert(pair<char,char>('N','T'));
-
-  // Map iterator
-  pair<MyMap::iterator,MyMap::iterator> mapit;
-
-  ifstream input(_inputname.c_str());
-  ofstream output("tmp.txt");
-
-  if(input.is_open() && output.is_open())
-  {
-    _nlines = 0;
-    string line;
-
-    if(_labelled)
-    {
-      getline(input,line);
-      output << line << endl;
-    }
-
-    // We go through the input file
-    while(getline(input, line))
-    {
-      vector<string> words;
-      string word;
-      string * expansion;
-      int times = 1;
-
-      stringstream strstr(line);
-      while (getline(strstr, word, '\t'))
-        words.push_back(word);
-      size_t wordsize = words[0].size();
-
-      // We count how many words there will be instead
-      size_t found = words[0].find_first_of(cons_char);
-      while(found != string::npos)
-      {
-        times *= (int)mapping.count(words[0][found]);
-        found = words[0].find_first_of(cons_char, found+1);
-      }
-      int n = times;
-
-      // Array allocation;
-      expansion = new string[times];
-
-      // Array initialization
-      for(int i=0; i<times; ++i)
-        expansion[i] = words[0];
-
-      // We do the replacement
-      for(size_t j=0; j<wordsize; ++j)
-      {
-        vector<char> repl;
-        int count = mapping.count(words[0][j]);
-        mapit = mapping.equal_range(words[0][j]);
-        n /= count;
-
-        multimap<char,char>::iterator it;
-        for(it=mapit.first; it!=mapit.second; ++it)
-          repl.push_back(it->second);
-
-        for(int i=0; i<times; ++i)
-          expansion[i][j] = repl[(i/n)%count];
-      }
-
-      // We write the output file
-      for(int i=0; i<times; ++i)
-      {
-        output << expansion[i];
-        for(size_t j=1; j<words.size(); ++j)
-          output << "\t" << words[j];
-        output << endl;
-        ++_nlines;
-      }
-
-      // We delete the string array
-      delete [] expansion;
-    }
-    output.close();
-    input.close();
-
-    string old(_inputname);
-    old += ".old";
-
-    // We remove the old "old file" if it exists
-    remove(old.c_str());
-
-    // We rename the temp file
-    int res1 = rename(_inputname.c_str(), old.c_str());
-    int res2 = rename("tmp.txt", _inputname.c_str());
-    if(res1 != 0 || res2 != 0)
-      throw ios::failure( "Could not create new database file (extended notation)...");
-  }
-  else
-    throw ios::failure( "Error expanding the database file !" );
-}
-
-
-bool NucBase::search( NucSequences & sequences, const vector<int> & columns, int mismatch, int submatch, bool absent, bool seqfile, bool mapnum, vector<int> & progress ) const
+bool NucBase::search( NucSequences & sequences, const vector<int> & columns, int mismatch, int submatch, bool absent, bool seqfile, bool mapnum, vector<int> & progress, bool concatenated ) const
 {
   bool ok = false;
   bool bwt = true;
@@ -586,6 +702,16 @@ bool NucBase::search( NucSequences & sequences, const vector<int> & columns, int
     bwt_cost = _maxsize*(_maxsize-mismatch)*pow(4,mismatch)*(log(maxseqsize)-log(4));
     if(bwt_cost > _maxsize*maxseqsize*(log(maxseqsize)-log(4)))
       bwt_cost = _maxsize*maxseqsize*(log(maxseqsize)-log(4));
+
+    // With the bidirectional index, each part of the word is matched exactly first :
+    // only its occurrences (the seeds) are extended with the mismatches
+    if(!sequences.empty() && sequences[0].bidirectional())
+    {
+      double seeds = max(1.0, maxseqsize/pow(4,_maxsize/(mismatch+1)));
+      long long schemes_cost = (mismatch+1)*5*_maxsize*seeds;
+      if(schemes_cost < bwt_cost)
+        bwt_cost = schemes_cost;
+    }
   }
 
   // We see if bwt is more interesting
@@ -599,29 +725,63 @@ bool NucBase::search( NucSequences & sequences, const vector<int> & columns, int
   if(submatch > 9) options += 4; //Strings of 9 nucleotids will give too many results
   if(bwt == true ) options += 8;
 
-  // The way we browse the database depends on the options
-  switch(options)
+  // Exact search in short sequences : an automaton over all the reads (built once,
+  // about MYAUTOMATONCOST operations per character) then one pass over each sequence.
+  // It holds every read in both orientations, so it is bounded in memory
+  bool automaton = (options & 14) == 0 &&
+                   (double)_nlines*_maxsize*MYAUTOMATONCOST + nseq*meanseqsize < (double)nseq*_nlines*std_cost &&
+                   NucAutomaton::memory(2.0*_nlines*_maxsize) <= MYAUTOMATONMEMORY;
+
+  // With a single index over all the sequences, each read is searched once
+  // (else one index per sequence, when they are too long to be concatenated)
+  if(concatenated && nseq > 1 && NucConcatenation::fits(sequences))
   {
-    case 0 : ok = processDatabase<false, false, false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 1 : ok = processDatabase<true , false, false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 2 : ok = processDatabase<false, true , false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 3 : ok = processDatabase<true , true , false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 4 : ok = processDatabase<false, false, true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 5 : ok = processDatabase<true , false, true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 6 : ok = processDatabase<false, true , true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 7 : ok = processDatabase<true , true , true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 8 : ok = processDatabase<false, false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 9 : ok = processDatabase<true , false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 10: ok = processDatabase<false, true , false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 11: ok = processDatabase<true , true , false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 12: ok = processDatabase<false, false, true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 13: ok = processDatabase<true , false, true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 14: ok = processDatabase<false, true , true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    case 15: ok = processDatabase<true , true , true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
-    default: ok = processDatabase<false, false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+    switch(options & 7)
+    {
+      case 0 : ok = processConcatenated<false, false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 1 : ok = processConcatenated<true , false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 2 : ok = processConcatenated<false, true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 3 : ok = processConcatenated<true , true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 4 : ok = processConcatenated<false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 5 : ok = processConcatenated<true , false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 6 : ok = processConcatenated<false, true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 7 : ok = processConcatenated<true , true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
+    }
+  }
+  else if(automaton)
+  {
+    if(mapnum)
+      ok = processAutomaton<true >(sequences, columns, absent, progress);
+    else
+      ok = processAutomaton<false>(sequences, columns, absent, progress);
+  }
+  else
+  {
+    // The way we browse the database depends on the options
+    switch(options)
+    {
+      case 0 : ok = processDatabase<false, false, false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 1 : ok = processDatabase<true , false, false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 2 : ok = processDatabase<false, true , false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 3 : ok = processDatabase<true , true , false, false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 4 : ok = processDatabase<false, false, true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 5 : ok = processDatabase<true , false, true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 6 : ok = processDatabase<false, true , true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 7 : ok = processDatabase<true , true , true , false>(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 8 : ok = processDatabase<false, false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 9 : ok = processDatabase<true , false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 10: ok = processDatabase<false, true , false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 11: ok = processDatabase<true , true , false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 12: ok = processDatabase<false, false, true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 13: ok = processDatabase<true , false, true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 14: ok = processDatabase<false, true , true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      case 15: ok = processDatabase<true , true , true , true >(sequences, columns, mismatch, submatch, absent, progress); break;
+      default: ok = processDatabase<false, false, false, true >(sequences, columns, mismatch, submatch, absent, progress); break;
+    }
   }
 
-  if(seqfile)
+  // The matching parts are read back from the GFF3 outputs
+  if(seqfile && _gff3)
       saveChangedSequences(columns, sequences, mismatch, submatch, absent);
 
   return ok;
@@ -689,16 +849,17 @@ void NucBase::saveChangedSequences(const vector<int> & columns, NucSequences & s
           if(!sense)
             word = Nuc::complementary(word);
 
+          // (the degenerate bases of the reads match the ones they allow)
           if(sense)
           {
             for(int i=0; i<size; ++i)
-              if(tmp_s[pos1+i] == word[i])
+              if(Nuc::matches(word[i], tmp_s[pos1+i]))
                 tmp_s[pos1+i] = '*';
           }
           else
           {
             for(int i=0; i<size; ++i)
-              if(tmp_a[seqsize-1-pos2+i] == word[i])
+              if(Nuc::matches(word[i], tmp_a[seqsize-1-pos2+i]))
                 tmp_a[seqsize-1-pos2+i] = '*';
           }
         }
@@ -723,6 +884,88 @@ void NucBase::saveChangedSequences(const vector<int> & columns, NucSequences & s
 }
 
 
+void NucBase::filterContaminants(const string & fastafilename)
+{
+  _contaminated.clear();
+  if(fastafilename.empty())
+    return;
+
+  // One small index over all the contaminants
+  string filename = fastafilename;
+  NucSequences contaminants(filename);
+  if(contaminants.empty())
+    return;
+  if(!NucConcatenation::fits(contaminants))
+    throw invalid_argument( "The contaminant sequences are too long for a single index." );
+
+  NucConcatenation all(contaminants);
+  all.bwt();
+
+  // Each read is searched once per strand, the first hit gives its contaminant
+  int nlines = _table.rows();
+  int nchunks = (nlines + MYCHUNKSIZE - 1)/MYCHUNKSIZE;
+  vector<int> found(nlines, -1);
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif
+  for(int chunk=0; chunk<nchunks; ++chunk)
+  {
+    string antiseq;
+    NucPool pool;
+
+    int lend = min(nlines, (chunk+1)*MYCHUNKSIZE);
+    for(int l=chunk*MYCHUNKSIZE; l<lend; ++l)
+    {
+      NucView seq(_table.read(l), _table.readsize(l));
+      Nuc::complementary(seq, antiseq);
+
+      for(int strand=0; strand<2 && found[l]<0; ++strand)
+      {
+        pool.reset();
+        NucQuery & query = *pool.query();
+        query.sequence(strand == 0 ? seq : NucView(antiseq));
+        query.sense(strand == 0);
+        query.limit(1);
+
+        all.search<false,true>(query, pool, 0);
+        if(query.located() > 0)
+        {
+          saidx_t pos = query.position(0);
+          found[l] = all.where(pos, seq.size());
+        }
+      }
+    }
+  }
+
+  _contaminated.assign(nlines, 0);
+
+  // The reads left out are reported with all the columns of the database
+  string reportname = _outputfolder + "contaminants.txt";
+  ofstream report(reportname.c_str());
+  if(!report.is_open())
+    throw ios::failure( "Error opening " + reportname + " !" );
+
+  int ncols = _table.columns();
+  report << "labels";
+  for(int c=1; c<ncols; ++c)
+    report << '\t' << (c < (int)_labels.size() ? _labels[c] : string());
+  report << "\tcontaminant\n";
+
+  for(int l=0; l<nlines; ++l)
+  {
+    if(found[l] < 0)
+      continue;
+
+    _contaminated[l] = 1;
+    report.write(_table.read(l), _table.readsize(l));
+    for(int c=1; c<ncols; ++c)
+      report << '\t' << _table.field(l, c);
+    report << '\t' << contaminants[found[l]].name() << '\n';
+  }
+}
+
+
 void NucBase::checkColumns(vector<int> & columns)
 {
   int  nlabels = _labels.size();
@@ -734,7 +977,7 @@ void NucBase::checkColumns(vector<int> & columns)
 }
 
 
-void NucBase::labelOutputs(ofstream * output, const vector<int> & columns, const vector<string> & labels, string seqname) const
+void NucBase::labelOutputs(NucBuffer * output, const vector<int> & columns, const vector<string> & labels, string seqname) const
 {
   int ncol = columns.size();
   string mapnum = "";
@@ -745,14 +988,76 @@ void NucBase::labelOutputs(ofstream * output, const vector<int> & columns, const
   for(int i=0; i<ncol; ++i)
   {
       // GFF3
-      output[i+0*ncol] << "##gff_version 3" << endl;
-      output[i+0*ncol] << "##Index_subfeatures 1" << endl;
-      output[i+0*ncol] << endl;
+      output[i+0*ncol] << "##gff_version 3\n";
+      output[i+0*ncol] << "##Index_subfeatures 1\n";
+      output[i+0*ncol] << '\n';
 
       // Sense
-      output[i+1*ncol] << "labels\t" << labels[columns[i]] << "_on_" << seqname << "\t" << _labels[columns[i]] << mapnum << endl;
+      output[i+1*ncol] << "labels\t" << labels[columns[i]] << "_on_" << seqname << "\t" << _labels[columns[i]] << mapnum << '\n';
 
       // Antisense
-      output[i+2*ncol] << "labels\t" << labels[columns[i]] << "_on_" << seqname << "\t" << _labels[columns[i]] << mapnum << endl;
+      output[i+2*ncol] << "labels\t" << labels[columns[i]] << "_on_" << seqname << "\t" << _labels[columns[i]] << mapnum << '\n';
   }
 }
+
+
+bool NucBase::present(int l, const vector<int> & columns) const
+{
+  if(!_contaminated.empty() && _contaminated[l])
+    return false;
+
+  for(size_t i=0; i<columns.size(); ++i)
+    if(columns[i] == 0 || !_table.zero(l, columns[i]))
+      return true;
+
+  return false;
+}
+
+
+bool NucBase::writeSums(const vector<vector<int> > & sums, const vector<int> & columns,
+                        const vector<string> & labels, int nseq, bool absent) const
+{
+  bool output_open = true;
+  int ncol = columns.size();
+
+  for(int i=0; i<ncol; ++i)
+  {
+    const vector<int> & sum = sums[i];
+    ostringstream oss;
+
+    oss << _outputfolder
+        << labels[columns[i]] << "_"
+        << nseq << "seqs";
+
+    string name_mapnum(oss.str());
+    name_mapnum += "_mapnum.txt";
+
+    ofstream output(name_mapnum.c_str());
+    output_open &= output.is_open();
+
+    if(output_open)
+    {
+      output << "labels\tmap_number\t" << labels[columns[i]] << '\n';
+
+      for(int l=0; l<_nlines; ++l)
+      {
+        // (the contaminant reads were not searched)
+        if(!_contaminated.empty() && _contaminated[l])
+          continue;
+
+        if((sum[l]>0) != absent)
+        {
+          output.write(_table.read(l), _table.readsize(l));
+          output << "\t" << sum[l] << "\t";
+          if(columns[i]==0)
+            output.write(_table.read(l), _table.readsize(l));
+          else
+            output << _table.field(l, columns[i]);
+          output << '\n';
+        }
+      }
+    }
+  }
+
+  return output_open;
+}
@@ -6,18 +6,43 @@
 #include <vector>
 #include <string>
 #include "nucsequences.hpp"
+#include "nuctable.hpp"
+#include "nucoutput.hpp"
+#include "nucinput.hpp"
+#include "nucautomaton.hpp"
+#include "nuccollapser.hpp"
+#include "nuctrimmer.hpp"
 using namespace std;
 
+// Number of database lines processed together by one thread
+#define MYCHUNKSIZE 4096
+
+// Relative cost of a character of the reads when building the automaton (exact search)
+#define MYAUTOMATONCOST 4
+
+// Memory the automaton may take (bytes), the reads are searched with the index above it
+#define MYAUTOMATONMEMORY 1073741824.0
+
+// Bytes of a fastq/fasta file read at once by the converters (then parsed in parallel)
+#define MYCONVERTBLOCK 33554432
+
 // Utility functions
 
 enum fq_encoding { SANGER=0, SOLEXA=1, IL13=2, IL15=3, IL18=4 };
 
+// With a UMI size, the reads are counted once per distinct UMI, read umioffset bases after the 3' adapter
 void fastq2txt(string inputname, string & adapter3, string & adapter5,
-               fq_encoding encoding, int minsize=0, int maxsize=0, int score=0);
+               fq_encoding encoding, int minsize=0, int maxsize=0, int score=0,
+               int umisize=0, int umioffset=0);
 
 void fasta2txt(string inputname, string & adapter3, string & adapter5,
                int minsize=0, int maxsize=0);
 
+// Converts several libraries (fastq or fasta files) into one database, one column per library
+void libraries2txt(const vector<string> & inputnames, const string & outputname, bool fastq,
+                   string & adapter3, string & adapter5, fq_encoding encoding=SANGER,
+                   int minsize=0, int maxsize=0, int score=0, int umisize=0, int umioffset=0);
+
 
 class NucBase
 {
@@ -32,6 +57,10 @@ class NucBase
     int            _colname;
     int            _nlines;
     int            _maxsize;
+    bool           _gff3;         // GFF3 outputs written
+    int            _maxpositions; // Positions located per read (all of them if negative)
+    vector<char>   _contaminated; // Lines found in the contaminants, left out of the searches (none if empty)
+    NucTable       _table;     // Database content, loaded once
   
   
   
@@ -57,31 +86,52 @@ class NucBase
                  bool absent,
                  bool seqfile,
                  bool mapnum,
-                 vector<int> &progress) const;
+                 vector<int> &progress,
+                 bool concatenated = false) const;
 
     // Gives the columns names
     void getLabels(vector<string> & labels) { labels.clear(); labels = _labels; }
 
     // Puts labels in the output files
-    void labelOutputs(ofstream * output, const vector<int> & columns, const vector<string> & labels, string seqname) const;
+    void labelOutputs(NucBuffer * output, const vector<int> & columns, const vector<string> & labels, string seqname) const;
 
     // Checks the desired columns
     void checkColumns(vector<int> & columns);
 
     // Gets the number of lines
     int getNlines() const { return _nlines; }
+
+    // Writes the GFF3 outputs or not (without them, the occurrences of the reads are only counted)
+    void setGff3(bool gff3) { _gff3 = gff3; }
+
+    // Locates at most max positions per read in each orientation, the others are only
+    // counted and the read is flagged as multi-mapping in the GFF3 (all of them if negative)
+    void setMaxPositions(int max) { _maxpositions = max; }
+
+    // Leaves out of the searches the reads found (exactly, on either strand) in the sequences of
+    // the fasta file : they are written to contaminants.txt with their counts (no filter if the name is empty)
+    void filterContaminants(const string & fastafilename);
   
   
   
   // Protected methods
   protected:
 
-    // Consensus-expansion
-    void expand();
-    
     // Saves the sequences without matching parts
     void saveChangedSequences(const vector<int> & columns, NucSequences &sequences,
                               int mismatches, int submatches, bool absent) const;
+
+    // Checks if the read of line l is present (!="0") in at least one of the columns
+    bool present(int l, const vector<int> & columns) const;
+
+    // Positions to locate per query (none without the GFF3 outputs, only the counts are written).
+    // It is set on the reads only : the fragments of the submatch searches come from the pool
+    // without a limit, their positions are still located for the merge and the maximal matches
+    int positionLimit() const { return _gff3 ? _maxpositions : 0; }
+
+    // Writes the number of hits of each read over all the sequences (mapnum)
+    bool writeSums(const vector<vector<int> > & sums, const vector<int> & columns,
+                   const vector<string> & labels, int nseq, bool absent) const;
   
   
   
@@ -91,10 +141,31 @@ class NucBase
     // Opens and browses the input file
     template <bool MAPNUM, bool MISMATCHES, bool SUBMATCHES, bool BWT>
     bool processDatabase(NucSequences & sequences, const vector<int> & columns, int mismatch, int submatch, bool absent, vector<int> & progress) const;
+
+    // Same, with a single index over all the sequences (one search per read)
+    template <bool MAPNUM, bool MISMATCHES, bool SUBMATCHES>
+    bool processConcatenated(NucSequences & sequences, const vector<int> & columns, int mismatch, int submatch, bool absent, vector<int> & progress) const;
+
+    // Same for exact searches, with an automaton over all the reads (one pass over each sequence)
+    template <bool MAPNUM>
+    bool processAutomaton(NucSequences & sequences, const vector<int> & columns, bool absent, vector<int> & progress) const;
+
+    // Labels of the results (with the options)
+    template <bool MISMATCHES, bool SUBMATCHES>
+    void resultLabels(vector<string> & labels, int mismatch, int submatch, bool absent) const;
+
+    // Opens the output files of a sequence and writes their labels
+    template <bool MAPNUM>
+    bool openOutputs(NucWriter & writer, const string & seqname, const vector<int> & columns, const vector<string> & labels, int * output) const;
+
+    // Outputs the results of one read in a sequence, for all the defined columns
+    template <bool MAPNUM, bool SUBMATCHES>
+    void writeResults(NucBuffer * buffer, NucBuffer & gff3, NucQuery & sense, NucQuery & antisense, NucSequence & sequence,
+                      const vector<int> & columns, int l, bool absent, vector<vector<int> > * sums) const;
     
     // Outputs one search result
     template <bool GFF3, bool SUBMATCHES>
-    void writeOutput(ofstream & out, NucQuery & query, NucSequence & sequence, bool absent, const string & val, const string & mapnum) const;
+    void writeOutput(NucBuffer & out, NucQuery & query, NucSequence & sequence, bool absent, const string & val, const string & mapnum) const;
 };
 
 #include "nucbase.hxx"
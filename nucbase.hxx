@@ -25,49 +25,41 @@ bool NucBase::processDatabase(NucSequences & sequences, const vector<int> & colu
       sums.resize(ncol, vector<int>(_nlines,0));
 
   // We modify the labels with mismatches and submatches info
-  vector<string> newLabels(_labels);
-  vector<string>::iterator it;
-  for(it=newLabels.begin(); it<newLabels.end(); ++it)
-  {
-    ostringstream oss;
-    oss << *it;
-
-    if(absent)
-      oss << "_absent";
-
-    if(MISMATCHES)
-      oss << "_" << mismatch << "mm";
+  vector<string> newLabels;
+  resultLabels<MISMATCHES, SUBMATCHES>(newLabels, mismatch, submatch, absent);
 
-    if(SUBMATCHES)
-      oss << "_" << submatch << "minblock";
+  // Positions located per read (the counts are always complete)
+  int limit = positionLimit();
 
-    // We modify the labels
-    *it = oss.str();
-  }
-
-  // We try to be multithread
-  #ifdef OMP_H
+  // We try to be multithread : over the sequences, or over chunks of database lines
+  // when there are fewer sequences than threads (one genome, a pasted sequence...)
   int numthreads = 1;
-  numthreads = max(min(omp_get_num_procs(), nseq), 1);
-  omp_set_num_threads(numthreads);
+  bool linechunks = false;
+  #ifdef _OPENMP
+  int maxthreads = max(omp_get_max_threads(), 1);
+  linechunks = nseq < maxthreads;
+  numthreads = linechunks ? maxthreads : max(min(maxthreads, nseq), 1);
   progress.resize(numthreads,0);
   #endif
 
-  #ifdef OMP_H
-  #pragma omp parallel for
+  // The results are written by a background thread
+  NucWriter writer;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(numthreads) if(!linechunks)
   #endif
   for(int j=0; j<nseq; ++j)
   {
-    int thread = 0;
+    int seqthread = 0;
 
-    #ifdef OMP_H
-    thread = omp_get_thread_num();
+    #ifdef _OPENMP
+    seqthread = omp_get_thread_num();
     #endif
 
     // BWT
     if(BWT)
     {
-      #ifdef OMP_H
+      #ifdef _OPENMP
       #pragma omp critical
       #endif
       sequences[j].bwt();
@@ -78,163 +70,110 @@ bool NucBase::processDatabase(NucSequences & sequences, const vector<int> & colu
     int noutputs = 3*ncol;
     if(MAPNUM)
       noutputs += ncol;
-    ofstream * output = new ofstream[noutputs];
+    int * output = new int[noutputs];
 
-    for(int i=0; i<ncol; ++i)
+    // The database is already in memory
+    if(openOutputs<MAPNUM>(writer, sequences[j].name(), columns, newLabels, output))
     {
-      ostringstream oss;
-      oss << _outputfolder << sequences[j].name() << "/" << sequences[j].name() << "_" << newLabels[columns[i]];
-
-      string name_gff3(oss.str());
-      name_gff3 += ".gff3";
-      output[i+0*ncol].open(name_gff3.c_str());
-
-      string name_sense(oss.str());
-      name_sense += "_sense.txt";
-      output[i+1*ncol].open(name_sense.c_str());
+      // Chunks of lines are processed in parallel, then written in order
+      int nlines = _table.rows();
+      int nchunks = (nlines + MYCHUNKSIZE - 1)/MYCHUNKSIZE;
 
-      string name_antisense(oss.str());
-      name_antisense += "_antisense.txt";
-      output[i+2*ncol].open(name_antisense.c_str());
-
-      output_open &= output[i+0*ncol].is_open();
-      output_open &= output[i+1*ncol].is_open();
-      output_open &= output[i+2*ncol].is_open();
-
-
-      if(MAPNUM)
+      #ifdef _OPENMP
+      #pragma omp parallel for ordered schedule(dynamic) num_threads(numthreads) if(linechunks)
+      #endif
+      for(int chunk=0; chunk<nchunks; ++chunk)
       {
-        ostringstream oss;
+        int thread = seqthread;
 
-        oss << _outputfolder
-            << sequences[j].name() << "/"
-            << newLabels[columns[i]] << "_"
-            << sequences[j].name();
+        #ifdef _OPENMP
+        if(linechunks)
+          thread = omp_get_thread_num();
+        #endif
 
-        string name_mapnum(oss.str());
-        name_mapnum += "_mapnum.txt";
+        string valone = "1";
+        NucPool pool;
+        NucBuffer gff3;
+        NucBuffer * buffer = new NucBuffer[noutputs];
 
-        output[i+3*ncol].open(name_mapnum.c_str());
-        output_open &= output[i+3*ncol].is_open();
-
-        output[i+3*ncol] << "labels\t" << sequences[j].name() << "_mapnum\t" << newLabels[columns[i]] << endl;
-      }
-    }
-
-    // We open the database file
-    ifstream input(_inputname.c_str());
-    if(input.is_open() && output_open)
-    {
-      string line;
-      string valone = "1";
+        // The reads are searched by batches (the exact searches with the index go in lock-step)
+        int lend = min(nlines, (chunk+1)*MYCHUNKSIZE);
+        for(int b=chunk*MYCHUNKSIZE; b<lend; b+=MYBATCHSIZE)
+        {
+          // The queries of the previous batch are given back
+          pool.reset();
 
-      // Line number
-      int l = 0;
+          // Sense and antisense queries of the batch, and their lines
+          NucQuery * batch[2*MYBATCHSIZE];
+          int lines[MYBATCHSIZE];
+          int nbatch = 0;
 
-      // If the first line contains labels, we skip it
-      if(_labelled)
-        getline(input, line);
+          int bend = min(lend, b+MYBATCHSIZE);
+          for(int l=b; l<bend; ++l)
+          {
+            // We look for the read only if it is present (!="0") in at least one
+            // of the corresponding databases (==columns)
+            if(!present(l, columns))
+              continue;
 
-      // We label the output file
-      labelOutputs(output, columns, newLabels, sequences[j].name());
+            // We get the read and the additional info (if present), without copies
+            NucView seq(_table.read(l), _table.readsize(l));
+            NucView name = _colname==0?seq:NucView(_table.field(l, _colname));
 
-      // As long as we can read the file.
-      while(getline(input, line))
-      {
-        // We get and parse the line.
-        string word;
-        vector<string> words;
-        stringstream strstr(line);
-        while (getline(strstr, word, '\t'))
-          words.push_back(word);
-
-        // We get the additional info (if present)
-        const string & mapnum = words[_colmapnum];
-        const string & name = words[_colname];
-        const string & seq  = words[0];
-
-        // We process the defined columns
-        for(int i=0; i<ncol; ++i)
-        {
-          string & val = columns[i]==0?valone:words[columns[i]];
-
-          // But only if they are present (!="0") in the corresponding database (==column)
-          if(val != "0")
-          {
             // Sense
-            NucQuery sense;
+            NucQuery & sense = *pool.query();
             sense.name(name);
             sense.sequence(seq);
             sense.sense(true);
-
-            // We look for the sense piRNA in the sequence.
-            sequences[j].search<SUBMATCHES,MISMATCHES,BWT>(sense, mismatch, submatch);
-
-            // We output the sense results (gff3)
-            writeOutput<true , SUBMATCHES>(output[i+0*ncol], sense, sequences[j], absent, val, mapnum);
-            // We output the sense results (tables)
-            writeOutput<false, SUBMATCHES>(output[i+1*ncol], sense, sequences[j], absent, val, mapnum);
+            sense.limit(limit);
 
             // Antisense
-            NucQuery antisense;
+            NucQuery & antisense = *pool.query();
             antisense.name(name);
-            antisense.sequence(Nuc::complementary(seq));
+            antisense.complementary(seq);
             antisense.sense(false);
+            antisense.limit(limit);
 
-            // We look for the antisense piRNA in the sequence.
-            sequences[j].search<SUBMATCHES,MISMATCHES,BWT>(antisense, mismatch, submatch);
-
-            // We output the antisense results (gff3)
-            writeOutput<true , SUBMATCHES>(output[i+0*ncol], antisense, sequences[j], absent, val, mapnum);
-            // We output the antisense results (tables)
-            writeOutput<false, SUBMATCHES>(output[i+2*ncol], antisense, sequences[j], absent, val, mapnum);
-
-            if(MAPNUM)
-            {
-              int lsum = sense.count() + antisense.count();
-
-              if(SUBMATCHES)
-              {
-                NucQuery * elt = sense.next;
-                while(elt != 0)
-                {
-                  lsum += elt->count();
-                  elt = elt->next;
-                }
-
-                elt = antisense.next;
-                while(elt != 0)
-                {
-                  lsum += elt->count();
-                  elt = elt->next;
-                }
-              }
-
-              if(nseq > 1)
-              {
-                #ifdef OMP_H
-                #pragma omp atomic
-                #endif
-                sums[i][l] += lsum;
-              }
-              if((lsum>0) != absent)
-                output[i+3*ncol] << seq << "\t" << lsum << "\t" << val << endl;
-            }
+            lines[nbatch/2] = l;
+            batch[nbatch++] = &sense;
+            batch[nbatch++] = &antisense;
           }
+
+          // We look for the piRNAs in the sequence
+          if(BWT && !MISMATCHES)
+            sequences[j].search(batch, nbatch, pool);
+          else
+            for(int k=0; k<nbatch; ++k)
+              sequences[j].search<MISMATCHES,BWT>(*batch[k], pool, mismatch);
+
+          if(SUBMATCHES)
+            for(int k=0; k<nbatch; ++k)
+              sequences[j].findFragments<MISMATCHES,BWT>(*batch[k], pool, mismatch, submatch);
+
+          // We fan the hits out to the defined columns, in the database order
+          for(int k=0; k<nbatch; k+=2)
+            writeResults<MAPNUM, SUBMATCHES>(buffer, gff3, *batch[k], *batch[k+1], sequences[j], columns, lines[k/2], absent, nseq > 1 ? &sums : 0);
+
+          progress[thread] += bend-b;
         }
 
-        if(MAPNUM)
-          ++l;
+        // We write the chunk results in the database order
+        #ifdef _OPENMP
+        #pragma omp ordered
+        #endif
+        {
+          for(int i=0; i<noutputs; ++i)
+            writer.write(output[i], buffer[i]);
+        }
 
-        ++progress[thread];
+        delete [] buffer;
       }
-      input.close();
 
       for(int i=0; i<noutputs; ++i)
-        output[i].close();
+        writer.close(output[i]);
     }
     else
-      throw ios::failure( "ProcessDatabase : error opening database and/or results files !" );
+      throw ios::failure( "ProcessDatabase : error opening results files !" );
 
     delete [] output;
 
@@ -243,83 +182,565 @@ bool NucBase::processDatabase(NucSequences & sequences, const vector<int> & colu
       sequences[j].inverse_bwt();
   }
 
+  // We wait for the results to be written
+  output_open &= writer.finish();
+
+  if(MAPNUM)
+    if(nseq > 1)
+      output_open &= writeSums(sums, columns, newLabels, nseq, absent);
+
+  return output_open;
+}
+
+
+template <bool MAPNUM, bool MISMATCHES, bool SUBMATCHES>
+bool NucBase::processConcatenated(NucSequences & sequences, const vector<int> & columns, int mismatch, int submatch, bool absent, vector<int> &progress) const
+{
+  bool output_open = true;
+
+  int  ncol = columns.size();
+  int  nseq = sequences.size();
+
+  vector<vector<int> > sums;
   if(MAPNUM)
-  {
     if(nseq > 1)
+      sums.resize(ncol, vector<int>(_nlines,0));
+
+  // We modify the labels with mismatches and submatches info
+  vector<string> newLabels;
+  resultLabels<MISMATCHES, SUBMATCHES>(newLabels, mismatch, submatch, absent);
+
+  // One index for all the sequences (every position is located : they give the sequence
+  // of each hit, so the reads are not limited here)
+  NucConcatenation all(sequences);
+  all.bwt();
+
+  // The results are written by a background thread
+  NucWriter writer;
+
+  // We initialize the outputs, for every sequence
+  // array : 1st quarter: gff3, 2nd quarter: sense, 3rd quarter: antisense, 4th quarter: seq_mapnum
+  int noutputs = 3*ncol;
+  if(MAPNUM)
+    noutputs += ncol;
+  vector<int> output(nseq*noutputs);
+
+  for(int j=0; j<nseq; ++j)
+    output_open &= openOutputs<MAPNUM>(writer, sequences[j].name(), columns, newLabels, &output[j*noutputs]);
+
+  if(!output_open)
+    throw ios::failure( "ProcessConcatenated : error opening results files !" );
+
+  // Chunks of lines are processed in parallel, then written in order
+  int numthreads = 1;
+  #ifdef _OPENMP
+  numthreads = max(omp_get_max_threads(), 1);
+  progress.resize(numthreads,0);
+  #endif
+
+  int nlines = _table.rows();
+  int nchunks = (nlines + MYCHUNKSIZE - 1)/MYCHUNKSIZE;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for ordered schedule(dynamic) num_threads(numthreads)
+  #endif
+  for(int chunk=0; chunk<nchunks; ++chunk)
+  {
+    int thread = 0;
+
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+
+    string antiseq;
+    NucPool pool;
+    NucBuffer gff3;
+    vector<NucBuffer> buffer(nseq*noutputs);
+    vector<NucHit> sensehits;
+    vector<NucHit> antisensehits;
+
+    int lend = min(nlines, (chunk+1)*MYCHUNKSIZE);
+    for(int l=chunk*MYCHUNKSIZE; l<lend; ++l)
     {
-      for(int i=0; i<ncol; ++i)
+      // We get the read and the additional info (if present), without copies
+      NucView seq(_table.read(l), _table.readsize(l));
+      NucView name = _colname==0?seq:NucView(_table.field(l, _colname));
+
+      // We look for the read only if it is present (!="0") in at least one
+      // of the corresponding databases (==columns)
+      if(present(l, columns))
       {
-        vector<int> & sum = sums[i];
-        ostringstream oss;
+        // The queries of the previous read are given back
+        pool.reset();
+
+        // Sense, in all the sequences at once (the maximal matches are found as in each sequence,
+        // the windows of the other searches are merged per sequence)
+        NucQuery & sense = *pool.query();
+        sense.name(name);
+        sense.sequence(seq);
+        sense.sense(true);
+
+        all.search<MISMATCHES,true>(sense, pool, mismatch);
+        bool sensemerge = false;
+        if(SUBMATCHES)
+        {
+          if(NucSequence::maximal<MISMATCHES>(sense))
+            all.maximalMatches(sense, pool, submatch);
+          else
+            sensemerge = all.fragments<MISMATCHES,true>(sense, pool, mismatch, submatch) != 0;
+        }
+        all.split(sense, sensehits);
+
+        // Antisense
+        Nuc::complementary(seq, antiseq);
+        NucQuery & antisense = *pool.query();
+        antisense.name(name);
+        antisense.sequence(antiseq);
+        antisense.sense(false);
+
+        all.search<MISMATCHES,true>(antisense, pool, mismatch);
+        bool antisensemerge = false;
+        if(SUBMATCHES)
+        {
+          if(NucSequence::maximal<MISMATCHES>(antisense))
+            all.maximalMatches(antisense, pool, submatch);
+          else
+            antisensemerge = all.fragments<MISMATCHES,true>(antisense, pool, mismatch, submatch) != 0;
+        }
+        all.split(antisense, antisensehits);
 
-        oss << _outputfolder
-            << newLabels[columns[i]] << "_"
-            << nseq << "seqs";
+        // We go through the sequences with hits (all of them to output the absent reads)
+        size_t s0 = 0;
+        size_t a0 = 0;
+        int j = 0;
+        for(;;)
+        {
+          if(!absent)
+          {
+            j = nseq;
+            if(s0 < sensehits.size())
+              j = sensehits[s0].seq;
+            if(a0 < antisensehits.size())
+              j = min(j, antisensehits[a0].seq);
+          }
 
-        string name_mapnum(oss.str());
-        name_mapnum += "_mapnum.txt";
+          if(j >= nseq)
+            break;
 
-        ofstream output(name_mapnum.c_str());
-        output_open &= output.is_open();
+          size_t s1 = s0;
+          while(s1 < sensehits.size() && sensehits[s1].seq == j)
+            ++s1;
 
-        ifstream input(_inputname.c_str());
-        if(input.is_open() && output_open)
-        {
-          string line;
-          string word;
-          int l = 0;
+          size_t a1 = a0;
+          while(a1 < antisensehits.size() && antisensehits[a1].seq == j)
+            ++a1;
 
-          if(_labelled)
-            getline(input,line);
+          // Hits of the sequence, as if it had been searched alone
+          NucQuery * last;
+          NucQuery * seqsense = NucConcatenation::extract(sense, sensehits, s0, s1, pool, last, sensemerge);
+          if(sensemerge)
+            NucSequence::merge(*seqsense, last, pool);
 
-          output << "labels\tmap_number\t" << newLabels[columns[i]] << endl;
+          NucQuery * seqantisense = NucConcatenation::extract(antisense, antisensehits, a0, a1, pool, last, antisensemerge);
+          if(antisensemerge)
+            NucSequence::merge(*seqantisense, last, pool);
 
-          while(getline(input, line))
-          {
-            vector<string> words;
-            stringstream strstr(line);
-            while (getline(strstr, word, '\t'))
-              words.push_back(word);
+          // We fan the hits out to the defined columns
+          writeResults<MAPNUM, SUBMATCHES>(&buffer[j*noutputs], gff3, *seqsense, *seqantisense, sequences[j], columns, l, absent, nseq > 1 ? &sums : 0);
+
+          s0 = s1;
+          a0 = a1;
+          ++j;
+        }
+      }
+
+      progress[thread] += nseq;
+    }
+
+    // We write the chunk results in the database order
+    #ifdef _OPENMP
+    #pragma omp ordered
+    #endif
+    {
+      for(int i=0; i<nseq*noutputs; ++i)
+        writer.write(output[i], buffer[i]);
+    }
+  }
+
+  for(int i=0; i<nseq*noutputs; ++i)
+    writer.close(output[i]);
+
+  // We wait for the results to be written
+  output_open &= writer.finish();
+
+  if(MAPNUM)
+    if(nseq > 1)
+      output_open &= writeSums(sums, columns, newLabels, nseq, absent);
+
+  return output_open;
+}
+
+
+template <bool MAPNUM>
+bool NucBase::processAutomaton(NucSequences & sequences, const vector<int> & columns, bool absent, vector<int> &progress) const
+{
+  bool output_open = true;
+
+  int  ncol = columns.size();
+  int  nseq = sequences.size();
 
-            if((sum[l]>0) != absent)
-                output << words[0] << "\t" << sum[l] << "\t" << words[columns[i]] << endl;
+  vector<vector<int> > sums;
+  if(MAPNUM)
+    if(nseq > 1)
+      sums.resize(ncol, vector<int>(_nlines,0));
+
+  // We modify the labels with the absent info
+  vector<string> newLabels;
+  resultLabels<false, false>(newLabels, 0, 0, absent);
 
-            ++l;
+  // One automaton for all the reads, in both orientations (word 2*l is the sense of line l,
+  // 2*l+1 its antisense). The reads with other characters than A, C, G and T are not in it,
+  // they are searched in each sequence as before
+  int nlines = _table.rows();
+  NucAutomaton automaton(2*nlines);
+  vector<char> scanned(nlines, 0);
+  {
+    string antiseq;
+    for(int l=0; l<nlines; ++l)
+      if(present(l, columns))
+      {
+        NucView seq(_table.read(l), _table.readsize(l));
+        Nuc::complementary(seq, antiseq);
+        scanned[l] = automaton.add(2*l, seq) && automaton.add(2*l+1, antiseq);
+      }
+  }
+  automaton.build();
+
+  // Positions kept per read (the counts are always complete)
+  int limit = positionLimit();
+
+  // The results are written by a background thread
+  NucWriter writer;
+
+  // Chunks of lines are processed in parallel, then written in order
+  int numthreads = 1;
+  #ifdef _OPENMP
+  numthreads = max(omp_get_max_threads(), 1);
+  progress.resize(numthreads,0);
+  #endif
+
+  // We initialize the outputs
+  // array : 1st quarter: gff3, 2nd quarter: sense, 3rd quarter: antisense, 4th quarter: seq_mapnum
+  int noutputs = 3*ncol;
+  if(MAPNUM)
+    noutputs += ncol;
+  vector<int> output(noutputs);
+
+  for(int j=0; j<nseq; ++j)
+  {
+    if(!openOutputs<MAPNUM>(writer, sequences[j].name(), columns, newLabels, &output[0]))
+      throw ios::failure( "ProcessAutomaton : error opening results files !" );
+
+    // All the occurrences in the sequence
+    automaton.scan(sequences[j].sequence());
+
+    int nchunks = (nlines + MYCHUNKSIZE - 1)/MYCHUNKSIZE;
+
+    #ifdef _OPENMP
+    #pragma omp parallel for ordered schedule(dynamic) num_threads(numthreads)
+    #endif
+    for(int chunk=0; chunk<nchunks; ++chunk)
+    {
+      int thread = 0;
+
+      #ifdef _OPENMP
+      thread = omp_get_thread_num();
+      #endif
+
+      string antiseq;
+      NucPool pool;
+      NucBuffer gff3;
+      vector<NucBuffer> buffer(noutputs);
+
+      int lend = min(nlines, (chunk+1)*MYCHUNKSIZE);
+      for(int l=chunk*MYCHUNKSIZE; l<lend; ++l)
+      {
+        // We get the read and the additional info (if present), without copies
+        NucView seq(_table.read(l), _table.readsize(l));
+        NucView name = _colname==0?seq:NucView(_table.field(l, _colname));
+
+        // We look for the read only if it is present (!="0") in at least one
+        // of the corresponding databases (==columns)
+        if(present(l, columns))
+        {
+          // The queries of the previous read are given back
+          pool.reset();
+
+          // Sense
+          NucQuery & sense = *pool.query();
+          sense.name(name);
+          sense.sequence(seq);
+          sense.sense(true);
+          sense.limit(limit);
+
+          // Antisense
+          Nuc::complementary(seq, antiseq);
+          NucQuery & antisense = *pool.query();
+          antisense.name(name);
+          antisense.sequence(antiseq);
+          antisense.sense(false);
+          antisense.limit(limit);
+
+          // The occurrences found by the scan, or a search for the other reads
+          if(scanned[l])
+          {
+            for(const saidx_t * it=automaton.begin(2*l); it!=automaton.end(2*l); ++it)
+              sense.addPosition(*it);
+            for(const saidx_t * it=automaton.begin(2*l+1); it!=automaton.end(2*l+1); ++it)
+              antisense.addPosition(*it);
+          }
+          else
+          {
+            sequences[j].search<false,false,false>(sense, pool, 0, 0);
+            sequences[j].search<false,false,false>(antisense, pool, 0, 0);
           }
+
+          // We fan the hits out to the defined columns
+          writeResults<MAPNUM, false>(&buffer[0], gff3, sense, antisense, sequences[j], columns, l, absent, nseq > 1 ? &sums : 0);
         }
+
+        ++progress[thread];
       }
+
+      // We write the chunk results in the database order
+      #ifdef _OPENMP
+      #pragma omp ordered
+      #endif
+      {
+        for(int i=0; i<noutputs; ++i)
+          writer.write(output[i], buffer[i]);
+      }
+    }
+
+    for(int i=0; i<noutputs; ++i)
+      writer.close(output[i]);
+  }
+
+  // We wait for the results to be written
+  output_open &= writer.finish();
+
+  if(MAPNUM)
+    if(nseq > 1)
+      output_open &= writeSums(sums, columns, newLabels, nseq, absent);
+
+  return output_open;
+}
+
+
+template <bool MISMATCHES, bool SUBMATCHES>
+void NucBase::resultLabels(vector<string> & labels, int mismatch, int submatch, bool absent) const
+{
+  labels = _labels;
+
+  for(vector<string>::iterator it=labels.begin(); it<labels.end(); ++it)
+  {
+    ostringstream oss;
+    oss << *it;
+
+    if(absent)
+      oss << "_absent";
+
+    if(MISMATCHES)
+      oss << "_" << mismatch << "mm";
+
+    if(SUBMATCHES)
+      oss << "_" << submatch << "minblock";
+
+    // We modify the labels
+    *it = oss.str();
+  }
+}
+
+
+template <bool MAPNUM>
+bool NucBase::openOutputs(NucWriter & writer, const string & seqname, const vector<int> & columns, const vector<string> & labels, int * output) const
+{
+  bool output_open = true;
+  int ncol = columns.size();
+  int noutputs = 3*ncol;
+  if(MAPNUM)
+    noutputs += ncol;
+
+  NucBuffer * header = new NucBuffer[noutputs];
+
+  for(int i=0; i<ncol; ++i)
+  {
+    ostringstream oss;
+    oss << _outputfolder << seqname << "/" << seqname << "_" << labels[columns[i]];
+
+    // Without the GFF3 outputs, their slots are left unused (-1, nothing is written)
+    output[i+0*ncol] = -1;
+    if(_gff3)
+    {
+      string name_gff3(oss.str());
+      name_gff3 += ".gff3";
+      output[i+0*ncol] = writer.open(name_gff3);
+      output_open &= output[i+0*ncol] >= 0;
     }
+
+    string name_sense(oss.str());
+    name_sense += "_sense.txt";
+    output[i+1*ncol] = writer.open(name_sense);
+
+    string name_antisense(oss.str());
+    name_antisense += "_antisense.txt";
+    output[i+2*ncol] = writer.open(name_antisense);
+
+    output_open &= output[i+1*ncol] >= 0;
+    output_open &= output[i+2*ncol] >= 0;
+
+
+    if(MAPNUM)
+    {
+      ostringstream oss;
+
+      oss << _outputfolder
+          << seqname << "/"
+          << labels[columns[i]] << "_"
+          << seqname;
+
+      string name_mapnum(oss.str());
+      name_mapnum += "_mapnum.txt";
+
+      output[i+3*ncol] = writer.open(name_mapnum);
+      output_open &= output[i+3*ncol] >= 0;
+
+      header[i+3*ncol] << "labels\t" << seqname << "_mapnum\t" << labels[columns[i]] << '\n';
+    }
+  }
+
+  // We label the output files
+  if(output_open)
+  {
+    labelOutputs(header, columns, labels, seqname);
+    for(int i=0; i<noutputs; ++i)
+      writer.write(output[i], header[i]);
   }
 
+  delete [] header;
+
   return output_open;
 }
 
 
+template <bool MAPNUM, bool SUBMATCHES>
+void NucBase::writeResults(NucBuffer * buffer, NucBuffer & gff3, NucQuery & sense, NucQuery & antisense, NucSequence & sequence,
+                           const vector<int> & columns, int l, bool absent, vector<vector<int> > * sums) const
+{
+  int ncol = columns.size();
+  static const string valone = "1";
+  const string & mapnum = _colmapnum==0?valone:_table.field(l, _colmapnum);
+
+  // The gff3 results do not depend on the column, we write them once
+  gff3.clear();
+  if(_gff3)
+  {
+    writeOutput<true , SUBMATCHES>(gff3, sense, sequence, absent, valone, mapnum);
+    writeOutput<true , SUBMATCHES>(gff3, antisense, sequence, absent, valone, mapnum);
+  }
+
+  int lsum = 0;
+  if(MAPNUM)
+  {
+    lsum = sense.count() + antisense.count();
+
+    if(SUBMATCHES)
+    {
+      NucQuery * elt = sense.next;
+      while(elt != 0)
+      {
+        lsum += elt->count();
+        elt = elt->next;
+      }
+
+      elt = antisense.next;
+      while(elt != 0)
+      {
+        lsum += elt->count();
+        elt = elt->next;
+      }
+    }
+  }
+
+  for(int i=0; i<ncol; ++i)
+  {
+    // But only if they are present (!="0") in the corresponding database (==column)
+    if(columns[i]!=0 && _table.zero(l, columns[i]))
+      continue;
+
+    const string & val = columns[i]==0?valone:_table.field(l, columns[i]);
+
+    // We output the results (gff3)
+    if(_gff3)
+      buffer[i+0*ncol] << gff3.str();
+    // We output the sense results (tables)
+    writeOutput<false, SUBMATCHES>(buffer[i+1*ncol], sense, sequence, absent, val, mapnum);
+    // We output the antisense results (tables)
+    writeOutput<false, SUBMATCHES>(buffer[i+2*ncol], antisense, sequence, absent, val, mapnum);
+
+    if(MAPNUM)
+    {
+      if(sums != 0)
+      {
+        #ifdef _OPENMP
+        #pragma omp atomic
+        #endif
+        (*sums)[i][l] += lsum;
+      }
+      if((lsum>0) != absent)
+      {
+        buffer[i+3*ncol].write(_table.read(l), _table.readsize(l));
+        buffer[i+3*ncol] << '\t' << lsum << '\t' << val << '\n';
+      }
+    }
+  }
+}
+
+
 template <bool GFF3, bool SUBMATCHES>
-void NucBase::writeOutput(ofstream & out, NucQuery & query, NucSequence & sequence, const bool absent, const string & val, const string & mapnum) const
+void NucBase::writeOutput(NucBuffer & out, NucQuery & query, NucSequence & sequence, const bool absent, const string & val, const string & mapnum) const
 {
   const string & seqname = sequence.name();
-  const string & queryname = query.name();
+  const NucView & queryname = query.name();
   if(GFF3)
   {
     size_t querysize = query.sequence().size();
-    int count = query.count();
+    int count = query.located();
+
+    // The reads with more hits than located positions are flagged (with all their hits)
+    string flag;
+    if(query.count() > count)
+    {
+      ostringstream oss;
+      oss << ";multimapping=" << query.count();
+      flag = oss.str();
+    }
 
     if(query.sense())
     {
       for(int i=0; i<count; ++i)
         out << seqname << "\tNucBase\tpiRNA\t" << 1+query.position(i) << "\t" << query.position(i)+querysize
-            << "\t.\t+\t.\tName=" << query.sequence() << ";Alias=" << queryname
+            << "\t.\t+\t.\tName=" << query.sequence() << ";Alias=" << queryname << flag
             //<< ";ID=" << info
-            << endl;
+            << '\n';
     }
     else
     {
       for(int i=0; i<count; ++i)
         out << seqname << "\tNucBase\tpiRNA\t" << 1+query.position(i) << "\t" << query.position(i)+querysize
-            << "\t.\t-\t.\tName=" << query.sequence() << ";Alias=" << queryname
+            << "\t.\t-\t.\tName=" << query.sequence() << ";Alias=" << queryname << flag
             //<< ";ID=" << info
-            << endl;
+            << '\n';
     }
   }
   else
@@ -341,16 +762,17 @@ void NucBase::writeOutput(ofstream & out, NucQuery & query, NucSequence & sequen
 
       // Info is mapnum in "tables" format
       if(_colmapnum > 0)
-        out << "\t" << mapnum << endl;
+        out << '\t' << mapnum << '\n';
       else
-        out << endl;
+        out << '\n';
     }
   }
 
   if(SUBMATCHES)
   {
-    // If we have submatches, we go through the (short) list (and delete it at the same time)
+    // If we have submatches, we go through the (short) list
     NucQuery * elt = query.next;
+    string seq;
     bool empty = (query.next == 0) & (query.count() == 0);
 
     while(elt != 0)
@@ -358,7 +780,7 @@ void NucBase::writeOutput(ofstream & out, NucQuery & query, NucSequence & sequen
       if(GFF3)
       {
         size_t querysize = elt->sequence().size();
-        int count = elt->count();
+        int count = elt->located();
 
         if(elt->sense())
         {
@@ -366,7 +788,7 @@ void NucBase::writeOutput(ofstream & out, NucQuery & query, NucSequence & sequen
             out << seqname << "\tNucBase\tpiRNA\t" << 1+elt->position(i) << "\t" << elt->position(i)+querysize
                 << "\t.\t+\t.\tName=" << elt->sequence() << ";Alias=" << queryname
                 //<< ";ID=" << info
-                << endl;
+                << '\n';
         }
         else
         {
@@ -374,19 +796,23 @@ void NucBase::writeOutput(ofstream & out, NucQuery & query, NucSequence & sequen
             out << seqname << "\tNucBase\tpiRNA\t" << 1+elt->position(i) << "\t" << elt->position(i)+querysize
                 << "\t.\t-\t.\tName=" << elt->sequence() << ";Alias=" << queryname
                 //<< ";ID=" << info
-                << endl;
+                << '\n';
         }
         elt = elt->next;
       }
       else
       {
-        string seq = elt->sequence();
-
-        if(!elt->sense())
-          seq = Nuc::complementary(seq);
-
         if( (elt->count() > 0) != absent )
-          out << seq << "\t" << elt->count() << endl;
+        {
+          if(elt->sense())
+            out << elt->sequence();
+          else
+          {
+            Nuc::complementary(elt->sequence(), seq);
+            out << seq;
+          }
+          out << '\t' << elt->count() << '\n';
+        }
 
         elt = elt->next;
       }
@@ -395,7 +821,7 @@ void NucBase::writeOutput(ofstream & out, NucQuery & query, NucSequence & sequen
     // We separate the submatches results (in "tables" format)
     if(!GFF3)
       if( empty == absent )
-        out << endl;
+        out << '\n';
   }
 }
 
@@ -0,0 +1,370 @@
+#include "nuccollapser.hpp"
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+using namespace std;
+
+
+namespace
+{
+  // 2-bit code of a base (-1 for the other characters : the read is kept as text)
+  inline int packed(char c)
+  {
+    switch(c)
+    {
+      case 'A': return 0;
+      case 'C': return 1;
+      case 'G': return 2;
+      case 'T': return 3;
+      default : return -1;
+    }
+  }
+
+  // Hash of a key (multiply-xorshift over its words)
+  inline uint64_t hashKey(const uint64_t * key, size_t n)
+  {
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for(size_t i=0; i<n; ++i)
+    {
+      h = (h ^ key[i]) * 0xFF51AFD7ED558CCDULL;
+      h ^= h >> 32;
+    }
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return h;
+  }
+
+  // Hash of a (read, UMI) pair
+  inline uint64_t hashUmi(uint64_t pair)
+  {
+    pair *= 0xFF51AFD7ED558CCDULL;
+    pair ^= pair >> 32;
+    return pair;
+  }
+
+  // Table of a hash (the high bits, the slots use the low ones)
+  inline int shardOf(uint64_t hash) { return (int)((hash >> 40) % MYSHARDS); }
+
+  // Character i of a key
+  inline char charAt(const uint64_t * key, size_t i)
+  {
+    static const char letters[4] = { 'A', 'C', 'G', 'T' };
+    if(key[0] & 1)
+      return (char)((key[1+i/8] >> (56-8*(i%8))) & 0xFF);
+    return letters[(key[1+i/32] >> (62-2*(i%32))) & 3];
+  }
+
+  // A distinct read of a sorted table, and its count
+  typedef pair<const uint64_t *, int> NucCount;
+
+  inline bool lessCount(const NucCount & a, const NucCount & b)
+  {
+    return NucCollapser::compare(a.first, b.first) < 0;
+  }
+
+  // Heap of the tables by their next read (the smallest on top)
+  struct NucHead
+  {
+    const vector<vector<NucCount> > * sorted;
+    const vector<size_t> * next;
+
+    bool operator()(int a, int b) const
+    {
+      return NucCollapser::compare((*sorted)[a][(*next)[a]].first, (*sorted)[b][(*next)[b]].first) > 0;
+    }
+  };
+}
+
+
+void NucReadBatch::add(const NucView & read, uint64_t umi)
+{
+  size_t size = read.size();
+
+  bool text = false;
+  for(size_t i=0; i<size && !text; ++i)
+    text = packed(read[i]) < 0;
+
+  // We pack the key first : the hash gives its table
+  size_t n = 1 + (text ? (size+7)/8 : (size+31)/32);
+  _key.assign(n, 0);
+  uint64_t * key = &_key[0];
+  key[0] = (((uint64_t)size) << 1) | (text ? 1 : 0);
+
+  if(text)
+    for(size_t i=0; i<size; ++i)
+      key[1+i/8] |= ((uint64_t)(unsigned char)read[i]) << (56-8*(i%8));
+  else
+    for(size_t i=0; i<size; ++i)
+      key[1+i/32] |= ((uint64_t)packed(read[i])) << (62-2*(i%32));
+
+  uint64_t hash = hashKey(key, n);
+  vector<uint64_t> & keys = _keys[shardOf(hash)];
+  keys.push_back(hash);
+  keys.push_back(umi);
+  keys.insert(keys.end(), key, key+n);
+}
+
+
+bool NucReadBatch::add(const NucView & read, const NucView & umi)
+{
+  if(umi.size() > MYUMISIZE)
+    return false;
+
+  uint64_t code = 0;
+  for(size_t i=0; i<umi.size(); ++i)
+  {
+    int base = packed(umi[i]);
+    if(base < 0)
+      return false;
+    code = (code << 2) | base;
+  }
+
+  add(read, code);
+  return true;
+}
+
+
+void NucReadBatch::clear()
+{
+  for(size_t s=0; s<_keys.size(); ++s)
+    _keys[s].clear();
+}
+
+
+void NucCollapser::grow(Shard & shard)
+{
+  size_t nslots = max((size_t)1024, 2*shard.slots.size());
+  shard.slots.assign(nslots, 0);
+
+  size_t mask = nslots-1;
+  for(size_t e=0; e<shard.entries.size(); ++e)
+  {
+    size_t i = shard.entries[e].hash & mask;
+    while(shard.slots[i] != 0)
+      i = (i+1) & mask;
+    shard.slots[i] = e+1;
+  }
+}
+
+
+uint32_t NucCollapser::insert(Shard & shard, uint64_t hash, const uint64_t * key)
+{
+  // Half of the slots at most are used (short probe sequences)
+  if(2*(shard.entries.size()+1) > shard.slots.size())
+    grow(shard);
+
+  size_t n = words(key);
+  size_t mask = shard.slots.size()-1;
+  for(size_t i = hash & mask; ; i = (i+1) & mask)
+  {
+    uint32_t e = shard.slots[i];
+
+    // New read
+    if(e == 0)
+    {
+      Entry entry = { hash, shard.arena.size(), 0 };
+      shard.arena.insert(shard.arena.end(), key, key+n);
+      shard.entries.push_back(entry);
+      shard.slots[i] = shard.entries.size();
+      return shard.entries.size()-1;
+    }
+
+    Entry & entry = shard.entries[e-1];
+    if(entry.hash == hash && equal(key, key+n, &shard.arena[entry.key]))
+      return e-1;
+  }
+}
+
+
+void NucCollapser::growUmis(Shard & shard)
+{
+  vector<uint64_t> umis(max((size_t)1024, 2*shard.umis.size()), 0);
+  umis.swap(shard.umis);
+
+  size_t mask = shard.umis.size()-1;
+  for(size_t u=0; u<umis.size(); ++u)
+  {
+    if(umis[u] == 0)
+      continue;
+
+    size_t i = hashUmi(umis[u]) & mask;
+    while(shard.umis[i] != 0)
+      i = (i+1) & mask;
+    shard.umis[i] = umis[u];
+  }
+}
+
+
+bool NucCollapser::insertUmi(Shard & shard, uint32_t entry, uint64_t umi)
+{
+  // Three quarters of the slots at most are used (the pairs are the largest part with UMIs)
+  if(4*(shard.numis+1) > 3*shard.umis.size())
+    growUmis(shard);
+
+  uint64_t pair = (((uint64_t)entry+1) << 32) | umi;
+  size_t mask = shard.umis.size()-1;
+  for(size_t i = hashUmi(pair) & mask; ; i = (i+1) & mask)
+  {
+    if(shard.umis[i] == pair)
+      return false;
+
+    if(shard.umis[i] == 0)
+    {
+      shard.umis[i] = pair;
+      ++shard.numis;
+      return true;
+    }
+  }
+}
+
+
+void NucCollapser::count(vector<NucReadBatch> & batches)
+{
+  int nbatches = batches.size();
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif
+  for(int s=0; s<MYSHARDS; ++s)
+  {
+    Shard & shard = _shards[s];
+    for(int b=0; b<nbatches; ++b)
+    {
+      vector<uint64_t> & keys = batches[b]._keys[s];
+      for(size_t k=0; k<keys.size(); k += 2 + words(&keys[k+2]))
+      {
+        uint32_t e = insert(shard, keys[k], &keys[k+2]);
+
+        // (a read with an UMI is counted if the pair is new)
+        uint64_t umi = keys[k+1];
+        if(umi == ~0ULL || insertUmi(shard, e, umi))
+          ++shard.entries[e].count;
+      }
+      keys.clear();
+    }
+  }
+}
+
+
+size_t NucCollapser::size() const
+{
+  size_t n = 0;
+  for(int s=0; s<MYSHARDS; ++s)
+    n += _shards[s].entries.size();
+  return n;
+}
+
+
+int NucCollapser::compare(const uint64_t * a, const uint64_t * b)
+{
+  size_t asize = a[0] >> 1;
+  size_t bsize = b[0] >> 1;
+  size_t n = min(asize, bsize);
+
+  if((a[0] & 1) == (b[0] & 1))
+  {
+    // Same packing : the first different word gives the first different character
+    int bits = (a[0] & 1) ? 8 : 2;
+    size_t per = 64/bits;
+    size_t nwords = (n+per-1)/per;
+    for(size_t w=0; w<nwords; ++w)
+    {
+      uint64_t x = a[1+w] ^ b[1+w];
+      if(x == 0)
+        continue;
+
+      size_t pos = w*per;
+      while((x << ((pos - w*per)*bits)) >> (64-bits) == 0)
+        ++pos;
+
+      if(pos < n)
+        return a[1+w] < b[1+w] ? -1 : 1;
+      break;
+    }
+  }
+  else
+  {
+    for(size_t i=0; i<n; ++i)
+    {
+      unsigned char ca = charAt(a, i);
+      unsigned char cb = charAt(b, i);
+      if(ca != cb)
+        return ca < cb ? -1 : 1;
+    }
+  }
+
+  // One is a prefix of the other
+  return asize < bsize ? -1 : (asize > bsize ? 1 : 0);
+}
+
+
+void NucCollapser::text(const uint64_t * key, string & text)
+{
+  size_t size = key[0] >> 1;
+  for(size_t i=0; i<size; ++i)
+    text.push_back(charAt(key, i));
+}
+
+
+void NucCollapser::write(ostream & out) const
+{
+  // Each table is sorted by a thread
+  vector<vector<NucCount> > sorted(MYSHARDS);
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+  #endif
+  for(int s=0; s<MYSHARDS; ++s)
+  {
+    const Shard & shard = _shards[s];
+    sorted[s].reserve(shard.entries.size());
+    for(size_t e=0; e<shard.entries.size(); ++e)
+      sorted[s].push_back(NucCount(&shard.arena[shard.entries[e].key], shard.entries[e].count));
+    sort(sorted[s].begin(), sorted[s].end(), lessCount);
+  }
+
+  // Then they are merged (heap of the tables by their next read)
+  vector<size_t> next(MYSHARDS, 0);
+  NucHead head = { &sorted, &next };
+
+  vector<int> heap;
+  for(int s=0; s<MYSHARDS; ++s)
+    if(!sorted[s].empty())
+      heap.push_back(s);
+  make_heap(heap.begin(), heap.end(), head);
+
+  string buffer;
+  char digits[16];
+  while(!heap.empty())
+  {
+    pop_heap(heap.begin(), heap.end(), head);
+    int s = heap.back();
+    const NucCount & read = sorted[s][next[s]];
+
+    text(read.first, buffer);
+    buffer.push_back('\t');
+    int d = 0;
+    unsigned int count = read.second;
+    do {
+      digits[d++] = '0' + count%10;
+      count /= 10;
+    } while(count > 0);
+    while(d > 0)
+      buffer.push_back(digits[--d]);
+    buffer.push_back('\n');
+
+    if(buffer.size() >= 1048576)
+    {
+      out.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+
+    if(++next[s] < sorted[s].size())
+      push_heap(heap.begin(), heap.end(), head);
+    else
+      heap.pop_back();
+  }
+
+  out.write(buffer.data(), buffer.size());
+}
@@ -0,0 +1,115 @@
+#ifndef NUCCOLLAPSER_HPP
+#define NUCCOLLAPSER_HPP
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <stdint.h>
+#include "nucview.hpp"
+using namespace std;
+
+// Number of hash tables of the distinct reads (counted in parallel, one thread per table)
+#define MYSHARDS 64
+
+// Longest UMI (2 bits per base, packed in 32 bits)
+#define MYUMISIZE 16
+
+
+// Reads packed by one thread, grouped by table, before they are counted. A key is
+// its size (times 2, plus 1 if it is kept as text) followed by the characters : 2 bits
+// per base for the reads of A, C, G and T, 8 bits per character for the others
+// (first character in the high bits, so the keys of A, C, G and T compare as their text)
+class NucReadBatch
+{
+  friend class NucCollapser;
+
+  protected:
+    vector<vector<uint64_t> > _keys; // For each table : hash, UMI then key of each read
+    vector<uint64_t>          _key;  // Key being packed
+
+    // Packs a read and its UMI code
+    void add(const NucView & read, uint64_t umi);
+
+  public:
+    // Constructor
+    NucReadBatch() : _keys(MYSHARDS) {}
+
+    // Packs a read
+    void add(const NucView & read) { add(read, ~0ULL); }
+
+    // Packs a read and its UMI (false if the UMI is not made of A, C, G and T : the read is left out)
+    bool add(const NucView & read, const NucView & umi);
+
+    // Forgets the reads (the buffers are kept)
+    void clear();
+};
+
+
+// Distinct reads of a library and their counts : the reads are hashed into MYSHARDS
+// open-addressing tables, each of them filled by a single thread (no lock). With UMIs,
+// a read is counted once per distinct UMI (PCR duplicates are counted once) : the
+// (read, UMI) pairs seen are kept in a set of 64-bit words per table
+class NucCollapser
+{
+  protected:
+    struct Entry
+    {
+      uint64_t hash;
+      size_t   key;   // Offset of the key in the arena
+      int      count;
+    };
+
+    struct Shard
+    {
+      vector<uint64_t> arena;   // Keys of the distinct reads
+      vector<Entry>    entries;
+      vector<uint32_t> slots;   // Entry of each slot, plus one (0 if it is free)
+      vector<uint64_t> umis;    // Pairs seen : entry plus one (high bits), UMI code (0 if the slot is free)
+      size_t           numis;
+
+      Shard() : numis(0) {}
+    };
+
+    vector<Shard> _shards;
+
+    // Entry of a key in its table (added with a count of 0 if it is new)
+    static uint32_t insert(Shard & shard, uint64_t hash, const uint64_t * key);
+
+    // Adds a pair to the set of its table, false if it was already there
+    static bool insertUmi(Shard & shard, uint32_t entry, uint64_t umi);
+
+    // Doubles the number of slots of a table
+    static void grow(Shard & shard);
+
+    // Doubles the number of slots of the pairs of a table
+    static void growUmis(Shard & shard);
+
+  public:
+    // Constructor
+    NucCollapser() : _shards(MYSHARDS) {}
+
+    // Counts the reads of the batches (the tables in parallel), then empties them
+    void count(vector<NucReadBatch> & batches);
+
+    // Number of distinct reads
+    size_t size() const;
+
+    // Writes the distinct reads in their text order, with their counts ("read\tcount" lines) :
+    // the tables are sorted in parallel, then merged
+    void write(ostream & out) const;
+
+    // Words of a key (its size, then the characters)
+    static inline size_t words(const uint64_t * key)
+    {
+      size_t size = key[0] >> 1;
+      return 1 + ((key[0] & 1) ? (size+7)/8 : (size+31)/32);
+    }
+
+    // Comparison of two keys, in the order of their text (-1, 0 or 1)
+    static int compare(const uint64_t * a, const uint64_t * b);
+
+    // Text of a key (appended to text)
+    static void text(const uint64_t * key, string & text);
+};
+
+#endif // NUCCOLLAPSER_HPP
@@ -0,0 +1,216 @@
+#include "nucinput.hpp"
+#include <cctype>
+#include <algorithm>
+using namespace std;
+
+
+string uncompressedName(const string & filename)
+{
+  static const char * extensions[] = { ".gz", ".zst" };
+
+  for(size_t e=0; e<sizeof(extensions)/sizeof(extensions[0]); ++e)
+  {
+    string ext = extensions[e];
+    if(filename.size() <= ext.size())
+      continue;
+
+    size_t extpos = filename.size()-ext.size();
+    bool same = true;
+    for(size_t i=0; i<ext.size() && same; ++i)
+      same = tolower((unsigned char)filename[extpos+i]) == ext[i];
+
+    if(same)
+      return filename.substr(0, extpos);
+  }
+
+  return filename;
+}
+
+
+NucReader::NucReader(const string & filename, size_t blocksize) :
+  _gz(NULL), _file(NULL), _blocksize(blocksize), _end(false), _stop(false), _failed(false)
+{
+#ifdef NUC_ZSTD
+  _zstd = NULL;
+  _pending = 0;
+#endif
+
+  // We look at the magic number of the file for its format
+  FILE * file = fopen(filename.c_str(), "rb");
+  if(file == NULL)
+    return;
+
+  unsigned char magic[4] = { 0, 0, 0, 0 };
+  size_t nmagic = fread(magic, 1, 4, file);
+  bool zstd = nmagic == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD;
+
+  if(zstd)
+  {
+#ifdef NUC_ZSTD
+    rewind(file);
+    _file = file;
+    _zstd = ZSTD_createDStream();
+    ZSTD_initDStream(_zstd);
+    _input.resize(ZSTD_DStreamInSize());
+    _buffer.src = _input.data();
+    _buffer.size = 0;
+    _buffer.pos = 0;
+#else
+    fclose(file);
+    return;
+#endif
+  }
+  else
+  {
+    // Zlib reads the files which are not compressed as they are
+    fclose(file);
+    _gz = gzopen(filename.c_str(), "rb");
+    if(_gz == NULL)
+      return;
+    gzbuffer(_gz, 1048576);
+  }
+
+  _thread = thread(&NucReader::run, this);
+}
+
+
+NucReader::~NucReader()
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stop = true;
+    _room.notify_one();
+  }
+
+  if(_thread.joinable())
+    _thread.join();
+
+  if(_gz != NULL)
+    gzclose(_gz);
+  if(_file != NULL)
+    fclose(_file);
+#ifdef NUC_ZSTD
+  if(_zstd != NULL)
+    ZSTD_freeDStream(_zstd);
+#endif
+}
+
+
+bool NucReader::read(string & data)
+{
+  unique_lock<mutex> lock(_mutex);
+  while(_queue.empty() && !_end)
+    _ready.wait(lock);
+
+  if(_queue.empty())
+    return false;
+
+  // We take the block over when there is nothing to keep
+  if(data.empty())
+    data.swap(_queue.front());
+  else
+    data.append(_queue.front());
+  _queue.pop_front();
+  _room.notify_one();
+  return true;
+}
+
+
+bool NucReader::failed()
+{
+  lock_guard<mutex> lock(_mutex);
+  return _failed;
+}
+
+
+size_t NucReader::fill(char * data, size_t size)
+{
+  size_t done = 0;
+
+  if(_gz != NULL)
+  {
+    while(done < size)
+    {
+      int n = gzread(_gz, data+done, (unsigned int)min(size-done, (size_t)1073741824));
+
+      // A truncated file ends without an error of gzread, but gzerror gives it
+      int error = Z_OK;
+      if(n == 0)
+        gzerror(_gz, &error);
+
+      if(n < 0 || error != Z_OK)
+      {
+        lock_guard<mutex> lock(_mutex);
+        _failed = true;
+      }
+      if(n <= 0)
+        break;
+      done += n;
+    }
+  }
+#ifdef NUC_ZSTD
+  else
+  {
+    ZSTD_outBuffer output = { data, size, 0 };
+    while(output.pos < output.size)
+    {
+      // We need more of the compressed file
+      if(_buffer.pos == _buffer.size)
+      {
+        _buffer.size = fread(&_input[0], 1, _input.size(), _file);
+        _buffer.pos = 0;
+        if(_buffer.size == 0)
+        {
+          // The last frame must be complete
+          if(_pending != 0 || ferror(_file))
+          {
+            lock_guard<mutex> lock(_mutex);
+            _failed = true;
+          }
+          break;
+        }
+      }
+
+      _pending = ZSTD_decompressStream(_zstd, &output, &_buffer);
+      if(ZSTD_isError(_pending))
+      {
+        lock_guard<mutex> lock(_mutex);
+        _failed = true;
+        break;
+      }
+    }
+    done = output.pos;
+  }
+#endif
+
+  return done;
+}
+
+
+void NucReader::run()
+{
+  for(;;)
+  {
+    // We read without holding the lock
+    string block(_blocksize, '\0');
+    block.resize(fill(&block[0], _blocksize));
+
+    unique_lock<mutex> lock(_mutex);
+    while(_queue.size() >= MYREADQUEUE && !_stop)
+      _room.wait(lock);
+
+    if(_stop)
+      break;
+
+    if(block.empty() || _failed)
+    {
+      _end = true;
+      _ready.notify_one();
+      break;
+    }
+
+    _queue.push_back(string());
+    _queue.back().swap(block);
+    _ready.notify_one();
+  }
+}
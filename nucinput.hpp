@@ -0,0 +1,74 @@
+#ifndef NUCINPUT_HPP
+#define NUCINPUT_HPP
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+#ifdef NUC_ZSTD
+#include <zstd.h>
+#endif
+using namespace std;
+
+// Number of blocks read in advance by the reader thread (the queue is bounded)
+#define MYREADQUEUE 2
+
+
+// Name of a file without its compression extension (.gz, .zst)
+string uncompressedName(const string & filename);
+
+
+// Input file read by a background thread, by blocks of blocksize bytes : gzip files
+// are decompressed (and zstd ones, when built with NUC_ZSTD), plain files are read
+// as they are. The blocks wait in a bounded queue, so the reading and decompression
+// overlap the parsing of the previous blocks
+class NucReader
+{
+  protected:
+    gzFile             _gz;       // Plain and gzip files
+    FILE *             _file;     // Zstd files
+#ifdef NUC_ZSTD
+    ZSTD_DStream *     _zstd;
+    string             _input;    // Compressed data being decompressed
+    ZSTD_inBuffer      _buffer;
+    size_t             _pending;  // Last result of the decompression (0 at the end of a frame)
+#endif
+    size_t             _blocksize;
+    deque<string>      _queue;
+    mutex              _mutex;
+    condition_variable _ready;    // Blocks to parse
+    condition_variable _room;     // Room in the queue
+    bool               _end;      // The whole file has been read (reader thread)
+    bool               _stop;     // The reader thread has to stop
+    bool               _failed;
+    thread             _thread;
+
+    // Reader thread
+    void run();
+
+    // Reads up to size bytes of the (decompressed) file, fewer at the end of the file
+    size_t fill(char * data, size_t size);
+
+  private:
+    NucReader(const NucReader &);
+    NucReader & operator=(const NucReader &);
+
+  public:
+    // Constructor and destructor (the destructor stops the reader thread)
+    NucReader(const string & filename, size_t blocksize);
+    ~NucReader();
+
+    // True if the file could be opened
+    bool is_open() const { return _gz != NULL || _file != NULL; }
+
+    // Appends the next block to data, false at the end of the file (nothing appended)
+    bool read(string & data);
+
+    // True if the file could not be read or decompressed up to its end
+    bool failed();
+};
+
+#endif // NUCINPUT_HPP
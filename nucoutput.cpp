@@ -0,0 +1,171 @@
+#include "nucoutput.hpp"
+using namespace std;
+
+
+NucBuffer & NucBuffer::append(unsigned long long value, bool negative)
+{
+  // We write the digits backwards in a small local array
+  char digits[24];
+  char * end = digits + sizeof(digits);
+  char * p = end;
+
+  do
+  {
+    *--p = (char)('0' + value % 10);
+    value /= 10;
+  } while(value != 0);
+
+  if(negative)
+    *--p = '-';
+
+  _data.append(p, end - p);
+  return *this;
+}
+
+
+NucWriter::NucWriter() : _stop(false), _failed(false)
+{
+  _thread = thread(&NucWriter::run, this);
+}
+
+
+NucWriter::~NucWriter()
+{
+  finish();
+
+  for(size_t i=0; i<_files.size(); ++i)
+    delete _files[i];
+}
+
+
+int NucWriter::open(const string & filename)
+{
+  // We create (or empty) the file now, it is reopened by the writer thread
+  ofstream file(filename.c_str());
+  if(!file.is_open())
+    return -1;
+  file.close();
+
+  lock_guard<mutex> lock(_mutex);
+  _files.push_back(new ofstream);
+  _names.push_back(filename);
+  return (int)_files.size()-1;
+}
+
+
+void NucWriter::write(int file, NucBuffer & buffer)
+{
+  if(file < 0 || buffer.empty())
+    return;
+
+  unique_lock<mutex> lock(_mutex);
+  while(_queue.size() >= MYWRITEQUEUE)
+    _room.wait(lock);
+
+  // We take the buffer content over
+  _queue.push_back(Job());
+  _queue.back().file = file;
+  _queue.back().close = false;
+  buffer.swap(_queue.back().data);
+  buffer.clear();
+  _ready.notify_one();
+}
+
+
+void NucWriter::close(int file)
+{
+  if(file < 0)
+    return;
+
+  lock_guard<mutex> lock(_mutex);
+  _queue.push_back(Job());
+  _queue.back().file = file;
+  _queue.back().close = true;
+  _ready.notify_one();
+}
+
+
+bool NucWriter::finish()
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stop = true;
+    _ready.notify_one();
+  }
+
+  if(_thread.joinable())
+    _thread.join();
+
+  return !_failed;
+}
+
+
+void NucWriter::run()
+{
+  unique_lock<mutex> lock(_mutex);
+
+  for(;;)
+  {
+    while(_queue.empty() && !_stop)
+      _ready.wait(lock);
+
+    // We stop once everything has been written
+    if(_queue.empty())
+      break;
+
+    Job job;
+    job.file = _queue.front().file;
+    job.close = _queue.front().close;
+    job.data.swap(_queue.front().data);
+    _queue.pop_front();
+    ofstream * file = _files[job.file];
+    string name = file->is_open() ? string() : _names[job.file];
+    _room.notify_all();
+
+    // We write without holding the lock
+    lock.unlock();
+
+    bool failed = false;
+    if(job.close)
+    {
+      if(file->is_open())
+      {
+        file->close();
+        failed = file->fail();
+        _opened.remove(file);
+      }
+    }
+    else
+    {
+      if(!file->is_open())
+      {
+        // We close the oldest file if too many are open
+        if(_opened.size() >= MYOPENFILES)
+        {
+          ofstream * oldest = _opened.front();
+          _opened.pop_front();
+          oldest->close();
+          failed |= oldest->fail();
+        }
+
+        file->clear();
+        file->open(name.c_str(), ios::out | ios::app);
+        _opened.push_back(file);
+      }
+
+      file->write(job.data.data(), job.data.size());
+      failed |= file->fail();
+    }
+
+    lock.lock();
+    _failed |= failed;
+  }
+
+  // Files which were not closed
+  for(list<ofstream*>::iterator it=_opened.begin(); it!=_opened.end(); ++it)
+  {
+    (*it)->close();
+    _failed |= (*it)->fail();
+  }
+  _opened.clear();
+}
@@ -0,0 +1,109 @@
+#ifndef NUCOUTPUT_HPP
+#define NUCOUTPUT_HPP
+
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <list>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "nucview.hpp"
+using namespace std;
+
+// Number of buffers waiting for the writer thread (the queue is bounded)
+#define MYWRITEQUEUE 64
+
+// Number of output files kept open at the same time by the writer thread
+#define MYOPENFILES 128
+
+
+// Append-only text buffer (one per output file and per chunk of lines),
+// integers are formatted without any allocation
+class NucBuffer
+{
+  protected:
+    string _data;
+
+    // Integer formatting
+    NucBuffer & append(unsigned long long value, bool negative);
+
+  public:
+    // Constructor
+    NucBuffer() {}
+
+    // Content
+    const string & str() const { return _data; }
+    size_t size()  const { return _data.size(); }
+    bool   empty() const { return _data.empty(); }
+    void   clear() { _data.clear(); }
+    void   swap(string & data) { _data.swap(data); }
+
+    // Text
+    NucBuffer & write(const char * text, size_t size) { _data.append(text, size); return *this; }
+    NucBuffer & operator<<(const string & text) { _data.append(text); return *this; }
+    NucBuffer & operator<<(const char * text)   { _data.append(text); return *this; }
+    NucBuffer & operator<<(const NucView & text){ _data.append(text.data(), text.size()); return *this; }
+    NucBuffer & operator<<(char c)              { _data.push_back(c); return *this; }
+
+    // Integers
+    NucBuffer & operator<<(int value)                { return append(value<0 ? 0ULL-(unsigned long long)value : value, value<0); }
+    NucBuffer & operator<<(long value)               { return append(value<0 ? 0ULL-(unsigned long long)value : value, value<0); }
+    NucBuffer & operator<<(long long value)          { return append(value<0 ? 0ULL-(unsigned long long)value : value, value<0); }
+    NucBuffer & operator<<(unsigned int value)       { return append(value, false); }
+    NucBuffer & operator<<(unsigned long value)      { return append(value, false); }
+    NucBuffer & operator<<(unsigned long long value) { return append(value, false); }
+};
+
+
+// Output files written by a background thread : the computing threads hand
+// their full buffers over, and the writer does one large write per buffer.
+// Files are reopened (append) when needed, at most MYOPENFILES are open at once
+class NucWriter
+{
+  protected:
+    struct Job
+    {
+      int    file;
+      string data;
+      bool   close;
+    };
+
+    vector<ofstream*>  _files;
+    vector<string>     _names;
+    list<ofstream*>    _opened;  // Files currently open (writer thread only), oldest first
+    deque<Job>         _queue;
+    mutex              _mutex;
+    condition_variable _ready;   // Jobs to write
+    condition_variable _room;    // Room in the queue
+    bool               _stop;
+    bool               _failed;
+    thread             _thread;
+
+    // Writer thread
+    void run();
+
+  private:
+    NucWriter(const NucWriter &);
+    NucWriter & operator=(const NucWriter &);
+
+  public:
+    // Constructor and destructor (the destructor waits for the pending writes)
+    NucWriter();
+    ~NucWriter();
+
+    // Creates an output file, returns its number (-1 if it can't be created)
+    int open(const string & filename);
+
+    // Queues the buffer content for the file (the buffer is emptied)
+    void write(int file, NucBuffer & buffer);
+
+    // Closes the file once its pending buffers are written
+    void close(int file);
+
+    // Waits for all the writes, returns false if one failed
+    bool finish();
+};
+
+#endif // NUCOUTPUT_HPP
@@ -1,15 +1,38 @@
 #include "nucsequences.hpp"
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#if defined(__SSE2__) || (defined(__GNUC__) && defined(__x86_64__))
+#include <immintrin.h>
+#endif
 using namespace std;
 
+// Macro to get the process id (Windows vs Unix)
+#ifdef _WIN32
+#include <process.h>
+#define GETPID() _getpid()
+#else
+#include <unistd.h>
+#define GETPID() getpid()
+#endif
+
 
 namespace Nuc
 {
   string complementary(const string &seq)
   {
     string res;
-    for(string::const_reverse_iterator rit=seq.rbegin(); rit<seq.rend(); ++rit)
+    complementary(NucView(seq), res);
+    return res;
+  }
+
+  void complementary(const NucView &seq, string &res)
+  {
+    res.clear();
+    for(const char * rit=seq.data()+seq.size(); rit!=seq.data(); )
     {
+      --rit;
       char temp = 'N';
       switch(*rit)
       {
@@ -17,35 +40,459 @@ namespace Nuc
         case 'A': temp = 'T'; break;
         case 'G': temp = 'C'; break;
         case 'C': temp = 'G'; break;
-        // Unused
-        //case 'K': temp = 'M'; break;
-        //case 'S': temp = 'W'; break;
-        //case 'Y': temp = 'R'; break;
-        //case 'M': temp = 'K'; break;
-        //case 'W': temp = 'S'; break;
-        //case 'R': temp = 'Y'; break;
-        //case 'B': temp = 'V'; break;
-        //case 'D': temp = 'H'; break;
-        //case 'H': temp = 'D'; break;
-        //case 'V': temp = 'B'; break;
-        //case 'U': temp = 'A'; break;
+        // Degenerate bases of the reads
+        case 'K': temp = 'M'; break;
+        case 'S': temp = 'S'; break;
+        case 'Y': temp = 'R'; break;
+        case 'M': temp = 'K'; break;
+        case 'W': temp = 'W'; break;
+        case 'R': temp = 'Y'; break;
+        case 'B': temp = 'V'; break;
+        case 'D': temp = 'H'; break;
+        case 'H': temp = 'D'; break;
+        case 'V': temp = 'B'; break;
+        case 'U': temp = 'A'; break;
       }
       res.push_back(temp);
     }
-    return res;
+  }
+
+  uint64_t checksum(const string &seq)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for(string::const_iterator it=seq.begin(); it!=seq.end(); ++it)
+    {
+      hash ^= (unsigned char)*it;
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  bool degenerate(const NucView & word)
+  {
+    for(size_t i=0; i<word.size(); ++i)
+      if(base(word[i]) < 0)
+        return true;
+    return false;
+  }
+}
+
+
+// Binary I/O helpers for index files
+namespace
+{
+  template <class T>
+  void writeValue(ofstream & out, const T & val)
+  {
+    out.write((const char *)&val, sizeof(T));
+  }
+
+  template <class T>
+  bool readValue(ifstream & in, T & val)
+  {
+    return in.read((char *)&val, sizeof(T)).good();
+  }
+
+  template <class T, class A>
+  void writeVector(ofstream & out, const vector<T,A> & vec)
+  {
+    uint64_t size = vec.size();
+    writeValue(out, size);
+    if(size > 0)
+      out.write((const char *)&vec[0], size*sizeof(T));
+  }
+
+  template <class T, class A>
+  bool readVector(ifstream & in, vector<T,A> & vec)
+  {
+    uint64_t size = 0;
+    if(!readValue(in, size))
+      return false;
+
+    // A damaged size must not allocate more than the rest of the file
+    streampos pos = in.tellg();
+    in.seekg(0, ios::end);
+    streampos fileend = in.tellg();
+    in.seekg(pos);
+    if(!in.good() || size > (uint64_t)(fileend - pos)/sizeof(T))
+      return false;
+
+    vec.resize(size);
+    if(size > 0)
+      in.read((char *)&vec[0], size*sizeof(T));
+
+    return in.good();
+  }
+
+  // Checksum of a table of an index, 8 bytes at a time (the large tables are checked quickly)
+  template <class T, class A>
+  uint64_t hashVector(const vector<T,A> & vec, uint64_t hash)
+  {
+    size_t size = vec.size()*sizeof(T);
+    const unsigned char * data = size > 0 ? (const unsigned char *)&vec[0] : 0;
+
+    hash = (hash ^ size) * 0xFF51AFD7ED558CCDULL;
+    size_t i = 0;
+    for(; i+8 <= size; i += 8)
+    {
+      uint64_t word;
+      memcpy(&word, data+i, 8);
+      hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+      hash ^= hash >> 29;
+    }
+    for(; i<size; ++i)
+      hash = (hash ^ data[i]) * 1099511628211ULL;
+
+    return hash;
+  }
+
+  // Checksum of all the tables of an index, saved with them
+  uint64_t hashIndex(saidx_t end, saidx_t revend, int kmerdepth, const vector<saidx_t> & C, const vector<saidx_t> & SA,
+                     const NucBlocks & blocks, const vector<uint64_t> & sampled, const vector<saidx_t> & sampledrank,
+                     const NucBlocks & revblocks, const vector<saidx_t> & kmers)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = (hash ^ (uint32_t)end) * 0xFF51AFD7ED558CCDULL;
+    hash = (hash ^ (uint32_t)revend) * 0xFF51AFD7ED558CCDULL;
+    hash = (hash ^ (uint32_t)kmerdepth) * 0xFF51AFD7ED558CCDULL;
+    hash = hashVector(C, hash);
+    hash = hashVector(SA, hash);
+    hash = hashVector(blocks, hash);
+    hash = hashVector(sampled, hash);
+    hash = hashVector(sampledrank, hash);
+    hash = hashVector(revblocks, hash);
+    hash = hashVector(kmers, hash);
+    return hash;
+  }
+
+  // Occurrences of A, C, G and T in the whole BWT (the last block and the ones before it)
+  void totals(const NucBlocks & blocks, saidx_t seqsize, saidx_t * total)
+  {
+    const NucRankBlock & last = blocks.back();
+    for(short a=0; a<4; ++a)
+      total[a] = last.occ[a];
+
+    for(saidx_t modb=0; modb<seqsize%MYBLOCKSIZE; ++modb)
+      if(!((last.except[modb/64] >> (modb%64)) & 1))
+        ++total[(last.bwt[modb/32] >> (2*(modb%32))) & 3];
+  }
+
+  // Consistency of the tables of an index, so a damaged file is rebuilt instead of being used
+  bool validIndex(saidx_t seqsize, saidx_t end, saidx_t revend, int sarate, const vector<saidx_t> & C,
+                  const vector<saidx_t> & SA, const NucBlocks & blocks, const vector<uint64_t> & sampled,
+                  const vector<saidx_t> & sampledrank, const NucBlocks & revblocks, const vector<saidx_t> & kmers)
+  {
+    if(end < 0 || end >= seqsize || (!revblocks.empty() && (revend < 0 || revend >= seqsize)))
+      return false;
+
+    // The intervals of the bases follow the end character, N is between G and T
+    saidx_t total[4];
+    totals(blocks, seqsize, total);
+    saidx_t nN = seqsize - 1 - total[0] - total[1] - total[2] - total[3];
+    if(nN < 0)
+      return false;
+
+    static const char letters[4] = { 'A', 'C', 'G', 'T' };
+    saidx_t start = 1;
+    for(short a=0; a<4; ++a)
+    {
+      if(letters[a] == 'T')
+        start += nN;
+      if(total[a] > 0 && C[Nuc::order(letters[a])] != start)
+        return false;
+      start += total[a];
+    }
+
+    // The reversed index has the same counts
+    if(!revblocks.empty())
+    {
+      saidx_t revtotal[4];
+      totals(revblocks, seqsize, revtotal);
+      if(!equal(total, total+4, revtotal))
+        return false;
+    }
+
+    // The suffix array (or its samples) only holds positions of the sequence
+    if(sarate > 1)
+    {
+      saidx_t nwords = seqsize/64 + 1;
+      if((saidx_t)sampled.size() != nwords || (saidx_t)sampledrank.size() != nwords
+         || (saidx_t)SA.size() != sampledrank.back() + Nuc::popcount(sampled.back()))
+        return false;
+
+      for(saidx_t w=0; w<nwords; ++w)
+        if(sampledrank[w] < 0 || sampledrank[w] > (saidx_t)SA.size())
+          return false;
+    }
+
+    for(size_t k=0; k<SA.size(); ++k)
+      if(SA[k] < 0 || SA[k] >= seqsize)
+        return false;
+
+    for(size_t k=0; k<kmers.size(); ++k)
+      if(kmers[k] < 0 || kmers[k] > seqsize)
+        return false;
+
+    return true;
   }
 }
 
 
-NucQuery::~NucQuery()
+void NucSequence::merge(NucQuery & query, NucQuery * last, NucPool & pool)
 {
-  if(next != 0)
-    delete next;
-  next = 0;
+  // We merge adjacent submatches
+  NucQuery * elt = query.next;
+  NucQuery * nxt = elt->next;
+  while(nxt != 0)
+  {
+    NucView str1 = elt->sequence().substr(0,elt->sequence().size()-1);
+    NucView str2 = nxt->sequence().substr(1,nxt->sequence().size()-1);
+
+    NucQuery * lastprev = last;
+    if(str1 == str2)
+    {
+      vector<int> & ind = pool.indices(0);
+      for(int i=0;i<elt->count(); ++i)
+        for(int j=0;j<nxt->count(); ++j)
+          if(elt->position(i) == (nxt->position(j)+1))
+            ind.push_back(i);
+
+      if(ind.size() > 0)
+      {
+        last->next = pool.query();
+        last = last->next;
+
+        last->name(query.name());
+        last->sequence(nxt->sequence()[0], elt->sequence());
+        last->sense(query.sense());
+        last->next = 0;
+
+        for(int i=ind.size()-1;i>=0; --i)
+        {
+          last->addPosition(elt->position(ind[i])-1);
+          elt->removePosition(ind[i]);
+        }
+      }
+    }
+
+    if(str1 == str2 || elt->sequence().size() < nxt->sequence().size())
+    {
+      vector<int> & ind2rm = pool.indices(1);
+      for(int i=0;i<elt->count(); ++i)
+        for(int j=0;j<lastprev->count(); ++j)
+          if(elt->position(i) == lastprev->position(j))
+            ind2rm.push_back(i);
+
+      for(int i=ind2rm.size()-1;i>=0; --i)
+        elt->removePosition(ind2rm[i]);
+    }
+    elt = nxt;
+    nxt = elt->next;
+  }
+
+  // List cleaning (the removed nodes go back to the pool with the next reset)
+  elt = &query;
+  nxt = elt->next;
+  while(nxt != last)
+  {
+    if(nxt->count() == 0)
+    {
+      elt->next = nxt->next;
+      nxt->next = 0;
+    }
+    else
+      elt = nxt;
+    nxt = elt->next;
+  }
+  if(last->sequence() == query.sequence() || last->count() == 0)
+    elt->next = 0;
 }
 
 
-NucSequence::NucSequence(string & seqfilename) : _nuc(Nuc::index()), _nchar(_nuc.size()), _C(_nchar), _blocksize(MYBLOCKSIZE)
+NucQuery * NucSequence::maximalMatches(NucQuery & query, NucPool & pool, int submatches)
+{
+  // Alias to the sequence we are looking for
+  const NucView & word = query.sequence();
+  // Size of the word
+  saidx_t size = word.size();
+
+  if(size < submatches)
+    return 0;
+
+  // Interval of word[a..e) at 2*a, for the current end e : the ends are taken from the
+  // last one, each backward search overwrites the intervals of the end after it
+  vector<saidx_t> & interval = pool.intervals();
+  interval.assign(2*size, 0);
+  vector<NucMatch> & matches = pool.matches();
+
+  // word[a..e) does not occur for a <= empty (matching statistics : the longest
+  // substring ending at e is word[empty+1..e))
+  saidx_t empty = -1;
+
+  for(saidx_t e=size; e>=submatches; --e)
+  {
+    // Interval of word[a..e), from a = e-1
+    saidx_t a = e-1;
+    short ic = Nuc::order(word[a]);
+    saidx_t low = _C[ic] + rank(word[a], 0);
+    saidx_t high = _C[ic] + rank(word[a], _seqsize);
+
+    while(low < high)
+    {
+      // Rows extended by word[e], a sub-interval (the one of the search from e+1)
+      saidx_t extlow = 0;
+      saidx_t exthigh = 0;
+      if(e < size && a > empty)
+      {
+        extlow = interval[2*a];
+        exthigh = interval[2*a+1];
+      }
+
+      // If all the occurrences are extended by word[e], so are the ones of the longer substrings :
+      // their intervals are the ones of the search from e+1, already there
+      if(exthigh-extlow == high-low)
+        break;
+
+      interval[2*a] = low;
+      interval[2*a+1] = high;
+
+      // Interval of word[a-1..e), its rows are the occurrences extended by word[a-1]
+      saidx_t prevlow = 0;
+      saidx_t prevhigh = 0;
+      if(a > 0)
+      {
+        ic = Nuc::order(word[a-1]);
+        prevlow = _C[ic] + rank(word[a-1], low);
+        prevhigh = _C[ic] + rank(word[a-1], high);
+      }
+
+      // Candidate if some occurrence is extended on neither side (the whole word is the query itself)
+      if(e-a >= submatches && e-a < size)
+      {
+        saidx_t prevext = 0;
+        if(a > 0 && e < size && a-1 > empty)
+          prevext = interval[2*(a-1)+1] - interval[2*(a-1)];
+
+        if((high-low) - (exthigh-extlow) > (prevhigh-prevlow) - prevext)
+        {
+          NucMatch match = { a, e-a, low, high, extlow, exthigh };
+          matches.push_back(match);
+        }
+      }
+
+      low = prevlow;
+      high = prevhigh;
+      if(--a < 0)
+        break;
+    }
+
+    if(low >= high)
+      empty = a;
+  }
+
+  // Fragments by increasing size, then decreasing start. Each one keeps the occurrences
+  // extended neither by the previous character (BWT test) nor by the next one (sub-interval)
+  sort(matches.begin(), matches.end());
+
+  NucQuery * last = &query;
+  for(size_t m=0; m<matches.size(); ++m)
+  {
+    const NucMatch & match = matches[m];
+
+    NucQuery * elt = 0;
+    for(saidx_t k=match.low; k<match.high; ++k)
+    {
+      if(k >= match.extlow && k < match.exthigh)
+        continue;
+      if(match.start > 0 && bwtchar(k) == word[match.start-1])
+        continue;
+
+      if(elt == 0)
+      {
+        elt = pool.query();
+        elt->name(query.name());
+        elt->sequence(word.substr(match.start, match.size));
+        elt->sense(query.sense());
+        last->next = elt;
+        last = elt;
+      }
+
+      elt->addPosition(locate(k));
+    }
+  }
+
+  last->next = 0;
+
+  return last != &query ? last : 0;
+}
+
+
+void NucSequence::windowMatches(NucQuery & query, NucPool & pool)
+{
+  // Alias to the sequence we are looking for
+  const NucView & word = query.sequence();
+  // Size of the word
+  saidx_t size = word.size();
+  saidx_t seqsize = _sequence.size();
+
+  // (the windows are views of the word)
+  vector<NucMatch> & matches = pool.matches();
+  for(NucQuery * elt=query.next; elt!=0; elt=elt->next)
+  {
+    saidx_t start = elt->sequence().data() - word.data();
+    saidx_t window = elt->sequence().size();
+
+    for(int k=0; k<elt->located(); ++k)
+    {
+      saidx_t pos = elt->position(k);
+      if(start > 0 && pos > 0 && _sequence[pos-1] == word[start-1])
+        continue;
+
+      saidx_t e = start+window;
+      while(e < size && pos+e-start < seqsize && _sequence[pos+e-start] == word[e])
+        ++e;
+
+      // (the whole word is the query itself)
+      if(e-start < size)
+      {
+        NucMatch match = { start, e-start, pos, pos, 0, 0 };
+        matches.push_back(match);
+      }
+    }
+  }
+
+  // Same order as maximalMatches, the positions stay in the order of the text
+  stable_sort(matches.begin(), matches.end());
+
+  NucQuery * last = &query;
+  for(size_t m=0; m<matches.size(); ++m)
+  {
+    const NucMatch & match = matches[m];
+    if(m == 0 || match.start != matches[m-1].start || match.size != matches[m-1].size)
+    {
+      NucQuery * elt = pool.query();
+      elt->name(query.name());
+      elt->sequence(word.substr(match.start, match.size));
+      elt->sense(query.sense());
+      last->next = elt;
+      last = elt;
+    }
+
+    last->addPosition(match.low);
+  }
+
+  last->next = 0;
+}
+
+
+NucPool::~NucPool()
+{
+  for(size_t i=0; i<_queries.size(); ++i)
+    delete _queries[i];
+}
+
+
+NucSequence::NucSequence(string & seqfilename) : _nuc(Nuc::index()), _nchar(_nuc.size()), _C(_nchar), _sarate(1), _bidirectional(false), _kmersize(0), _kmerdepth(0)
 {
   // We get the sequence name
   size_t length = string::npos;
@@ -80,6 +527,9 @@ NucSequence::NucSequence(string & seqfilename) : _nuc(Nuc::index()), _nchar(_nuc
     // We check if the sequence is correct
     if(!check())
       throw invalid_argument( "Invalid characters in the sequence." );
+
+    // The index is saved next to the sequence file
+    _indexname = seqfilename + ".nbi";
   }
   else
     throw ios::failure( "Error opening sequence file !" );
@@ -102,89 +552,698 @@ bool NucSequence::check()
 }
 
 
+// A rank block must fit in one cache line
+static_assert(sizeof(NucRankBlock) == 64, "NucRankBlock must be 64 bytes long");
+
+
 void NucSequence::bwt()
 {
-  // Append end character
-  _sequence.append(1,(char)0);
+  // We reuse the index saved by a previous run if it is still valid
+  uint64_t checksum = 0;
+  bool loaded = false;
+  if(!_indexname.empty())
+  {
+    checksum = Nuc::checksum(_sequence);
+    loaded = loadIndex(checksum);
+  }
+
+  if(!loaded)
+  {
+    // Append end character (removed once the index is built)
+    _sequence.append(1,(char)0);
+
+    // Sizes
+    _seqsize = _sequence.size();
+
+    // Resize Suffix Array
+    _SA.resize(_seqsize,0);
+
+    // Temporarily use arrays for compatibility with libdivsufsort
+    // WARNING : we use the fact that data in vectors and strings is contiguous
+    saidx_t * SA = &_SA[0];
+    sauchar_t * str = (sauchar_t *)&_sequence[0];
+
+    // Suffix array computation
+    divsufsort(str, SA, _seqsize);
+
+    // Index construction
+    map<char,unsigned char>::iterator it;
+    for(it = _nuc.begin(); it != _nuc.end(); ++it)
+      sa_simplesearch(str, _seqsize, SA, _seqsize, it->first, &_C[it->second]);
+
+    // Rank blocks (packed BWT and occurrences before each block), read from the suffix array
+    buildBlocks(_sequence, SA, _seqsize, _blocks, _end);
+
+    // We remove the end character
+    _sequence.resize(_seqsize-1);
+
+    // Suffix array sampling : we only keep the positions multiple of the rate
+    if(_sarate > 1)
+    {
+      saidx_t nwords = _seqsize/64 + 1;
+      _sampled = vector<uint64_t>(nwords, 0);
+      _sampledrank = vector<saidx_t>(nwords, 0);
+
+      saidx_t nsampled = 0;
+      for(saidx_t k=0; k<_seqsize; ++k)
+      {
+        if(k%64 == 0)
+          _sampledrank[k/64] = nsampled;
+
+        if(_SA[k]%_sarate == 0)
+        {
+          _sampled[k/64] |= ((uint64_t)1) << (k%64);
+          _SA[nsampled++] = _SA[k];
+        }
+      }
+
+      // We release the memory of the full suffix array
+      vector<saidx_t>(_SA.begin(), _SA.begin()+nsampled).swap(_SA);
+    }
+  }
+
+  // The reversed index is only built when needed (it may already be in the file)
+  bool reversed = _bidirectional && _revblocks.empty();
+  if(reversed)
+    reverseIndex();
+
+  // Same for the lookup table, if its size changed
+  bool tabled = _kmerdepth != _kmersize;
+  if(tabled)
+    kmerTable();
+
+  // We save the index for the next runs
+  if(!_indexname.empty() && (!loaded || reversed || tabled))
+    saveIndex(checksum);
+}
+
+
+void NucSequence::kmers(int size)
+{
+  int depth = 0;
+  while(depth < MYMAXKMER && ((uint64_t)1 << (2*(depth+1))) <= (uint64_t)_sequence.size()+1)
+    ++depth;
+
+  _kmersize = max(0, min(size, depth));
+}
+
+
+void NucSequence::kmers(vector<NucSequence> & sequences, double memory)
+{
+  // The short sequences stop at their own depth
+  for(int size=MYMAXKMER; size>=0; --size)
+  {
+    double total = 0;
+    for(size_t j=0; j<sequences.size(); ++j)
+    {
+      sequences[j].kmers(size);
+      total += 2*sizeof(saidx_t)*(double)kmerOffset(sequences[j].kmers()+1);
+    }
+
+    if(total <= memory)
+      break;
+  }
+}
+
+
+void NucSequence::kmerTable()
+{
+  _kmerdepth = _kmersize;
+  vector<saidx_t>().swap(_kmers);
+
+  // Missing k-mers keep an empty interval
+  if(_kmerdepth > 0)
+  {
+    _kmers.assign(2*kmerOffset(_kmerdepth+1), 0);
+    kmerTable(0, 0, 0, _seqsize);
+  }
+}
+
+
+void NucSequence::kmerTable(int d, uint32_t code, saidx_t low, saidx_t high)
+{
+  static const char letters[4] = { 'A', 'C', 'G', 'T' };
+
+  // We put each character before the current k-mer
+  for(int x=0; x<4; ++x)
+  {
+    char c = letters[x];
+    short ic = Nuc::order(c);
+    saidx_t newlow = _C[ic] + rank(c, low);
+    saidx_t newhigh = _C[ic] + rank(c, high);
+    uint32_t newcode = (((uint32_t)x) << (2*d)) + code;
+
+    if(newlow >= newhigh)
+      continue;
+
+    _kmers[2*(kmerOffset(d+1)+newcode)] = newlow;
+    _kmers[2*(kmerOffset(d+1)+newcode)+1] = newhigh;
+
+    if(d+1 < _kmerdepth)
+      kmerTable(d+1, newcode, newlow, newhigh);
+  }
+}
+
+
+void NucSequence::buildBlocks(const string & text, const saidx_t * SA, saidx_t size, NucBlocks & blocks, saidx_t & end)
+{
+  saidx_t nb = size/MYBLOCKSIZE + 1;
 
-  // Sizes
-  _seqsize = _sequence.size();
-  saidx_t nb = (_seqsize+1)/_blocksize;
+  NucRankBlock empty = {};
+  blocks.assign(nb, empty);
+  for(saidx_t k=0; k<size; ++k)
+  {
+    NucRankBlock & block = blocks[k/MYBLOCKSIZE];
+    short modb = k%MYBLOCKSIZE;
 
-  // Resize Suffix Array
-  _SA.resize(_seqsize,0);
+    // Character in the BWT string (preceding the suffix)
+    char c = (char) 0;
+    if(SA[k] > 0)
+      c = text[SA[k]-1];
+    else
+      end = k;
 
-  // Temporarily use arrays for compatibility with libdivsufsort
-  // WARNING : we use the fact that data in vectors and strings is contiguous
-  saidx_t * SA = &_SA[0];
-  sauchar_t * str = (sauchar_t *)&_sequence[0];
+    if(c == 0 || c == 'N')
+      block.except[modb/64] |= ((uint64_t)1) << (modb%64);
+    else
+      block.bwt[modb/32] |= Nuc::code(c) << (2*(modb%32));
 
-  // Suffix array computation
-  divsufsort(str, SA, _seqsize);
+    // Increment counter for the next block
+    saidx_t ind = k/MYBLOCKSIZE + 1;
+    if(ind < nb && c != 0 && c != 'N')
+      ++blocks[ind].occ[Nuc::code(c)];
+  }
+
+  // Blocks values are cumulative
+  for(saidx_t ind=1; ind<nb; ++ind)
+    for(short a=0; a<4; ++a)
+      blocks[ind].occ[a] += blocks[ind-1].occ[a];
+}
 
-  // Index construction
-  map<char,unsigned char>::iterator it;
-  for(it = _nuc.begin(); it != _nuc.end(); ++it)
-    sa_simplesearch(str, _seqsize, SA, _seqsize, it->first, &_C[it->second]);
 
-  // BWT
-  _pidx = divbwt(str, str, NULL, _seqsize);
+void NucSequence::reverseIndex()
+{
+  // Reversed sequence, with the end character
+  string reversed(_sequence.rbegin(), _sequence.rend());
+  reversed.append(1,(char)0);
+
+  // Its suffix array is only needed to build the blocks (same counts, so same _C)
+  vector<saidx_t> SA(_seqsize, 0);
+  divsufsort((sauchar_t *)&reversed[0], &SA[0], _seqsize);
+
+  buildBlocks(reversed, &SA[0], _seqsize, _revblocks, _revend);
+}
+
+
+bool NucSequence::loadIndex(uint64_t checksum)
+{
+  ifstream file(_indexname.c_str(), ios::in | ios::binary);
+  if(!file.is_open())
+    return false;
 
-  // Bug correction : end-character always at the start of BWT
+  // We check the header against the current sequence and settings
+  char magic[sizeof(NUCINDEX_MAGIC)];
+  uint32_t version = 0;
+  uint32_t saidxsize = 0;
+  uint64_t filechecksum = 0;
+  uint64_t tablechecksum = 0;
+  saidx_t seqsize = 0;
   saidx_t end = 0;
-  while(SA[end] != 0 && end < _seqsize)
-    ++end;
+  saidx_t revend = 0;
+  int sarate = 0;
+  int kmerdepth = 0;
+  short blocksize = 0;
+  short nchar = 0;
 
-  for(saidx_t o=0; o<end; ++o)
-    _sequence[o] = _sequence[o+1];
-  _sequence[end] = (char) 0;
-  // End correction
+  file.read(magic, sizeof(magic));
+  readValue(file, version);
+  readValue(file, saidxsize);
+  readValue(file, filechecksum);
+  readValue(file, tablechecksum);
+  readValue(file, seqsize);
+  readValue(file, end);
+  readValue(file, revend);
+  readValue(file, sarate);
+  readValue(file, kmerdepth);
+  readValue(file, blocksize);
+  readValue(file, nchar);
 
-  // Occurrences table (divided in blocks to save space)
-  _occ = vector<saidx_t>(_nchar*(nb+1),0);
-  // For each block
-  for(saidx_t ind=1; ind<=nb; ++ind)
+  if(!file.good() || memcmp(magic, NUCINDEX_MAGIC, sizeof(magic)) != 0
+     || version != NUCINDEX_VERSION || saidxsize != sizeof(saidx_t)
+     || seqsize != (saidx_t)_sequence.size()+1 || sarate != _sarate
+     || blocksize != MYBLOCKSIZE || nchar != _nchar
+     || filechecksum != checksum)
+    return false;
+
+  // We read the tables in temporaries, so a truncated file leaves the sequence untouched
+  vector<saidx_t> C, SA, sampledrank, kmers;
+  NucBlocks blocks, revblocks;
+  vector<uint64_t> sampled;
+  bool ok = readVector(file, C) && readVector(file, SA) && readVector(file, blocks)
+         && readVector(file, sampled) && readVector(file, sampledrank)
+         && readVector(file, revblocks) && readVector(file, kmers);
+
+  if(!ok || (short)C.size() != _nchar || (sarate == 1 && (saidx_t)SA.size() != seqsize)
+     || (saidx_t)blocks.size() != seqsize/MYBLOCKSIZE + 1
+     || (!revblocks.empty() && revblocks.size() != blocks.size())
+     || kmerdepth < 0 || kmerdepth > MYMAXKMER
+     || kmers.size() != (kmerdepth > 0 ? 2*kmerOffset(kmerdepth+1) : 0))
+    return false;
+
+  // The tables must be the ones saved, and consistent
+  if(hashIndex(end, revend, kmerdepth, C, SA, blocks, sampled, sampledrank, revblocks, kmers) != tablechecksum
+     || !validIndex(seqsize, end, revend, sarate, C, SA, blocks, sampled, sampledrank, revblocks, kmers))
+    return false;
+
+  // The reversed index stays in the file for the bidirectional runs, it is not kept otherwise
+  if(!_bidirectional)
+    NucBlocks().swap(revblocks);
+
+  _seqsize = seqsize;
+  _end = end;
+  _revend = revend;
+  _C.swap(C);
+  _SA.swap(SA);
+  _blocks.swap(blocks);
+  _sampled.swap(sampled);
+  _sampledrank.swap(sampledrank);
+  _revblocks.swap(revblocks);
+  _kmerdepth = kmerdepth;
+  _kmers.swap(kmers);
+
+  return true;
+}
+
+
+void NucSequence::saveIndex(uint64_t checksum)
+{
+  // We write to a temporary file first, so other runs never see a partial index
+  ostringstream oss;
+  oss << _indexname << "." << GETPID() << ".tmp";
+  string tmpname = oss.str();
+  ofstream file(tmpname.c_str(), ios::out | ios::binary | ios::trunc);
+  if(!file.is_open())
+    return;
+
+  uint32_t version = NUCINDEX_VERSION;
+  uint32_t saidxsize = sizeof(saidx_t);
+  short blocksize = MYBLOCKSIZE;
+
+  file.write(NUCINDEX_MAGIC, sizeof(NUCINDEX_MAGIC));
+  writeValue(file, version);
+  writeValue(file, saidxsize);
+  writeValue(file, checksum);
+  writeValue(file, hashIndex(_end, _revend, _kmerdepth, _C, _SA, _blocks, _sampled, _sampledrank, _revblocks, _kmers));
+  writeValue(file, _seqsize);
+  writeValue(file, _end);
+  writeValue(file, _revend);
+  writeValue(file, _sarate);
+  writeValue(file, _kmerdepth);
+  writeValue(file, blocksize);
+  writeValue(file, _nchar);
+  writeVector(file, _C);
+  writeVector(file, _SA);
+  writeVector(file, _blocks);
+  writeVector(file, _sampled);
+  writeVector(file, _sampledrank);
+  writeVector(file, _revblocks);
+  writeVector(file, _kmers);
+
+  bool ok = file.good();
+  file.close();
+
+  // A missing index is not an error (read-only folder...), it will just be rebuilt
+  remove(_indexname.c_str());
+  if(!ok || rename(tmpname.c_str(), _indexname.c_str()) != 0)
+    remove(tmpname.c_str());
+}
+
+
+void NucSequence::inverse_bwt()
+{
+  // The sequence itself is kept, we only release the index (swap to free the memory)
+  vector<saidx_t>().swap(_SA);
+  NucBlocks().swap(_blocks);
+  NucBlocks().swap(_revblocks);
+  vector<saidx_t>().swap(_kmers);
+  _kmerdepth = 0;
+  vector<uint64_t>().swap(_sampled);
+  vector<saidx_t>().swap(_sampledrank);
+}
+
+
+void NucSequence::search(NucQuery ** queries, int n, NucPool & pool)
+{
+  // Interval and next character (backwards) of each query of the group
+  saidx_t low[MYBATCHSIZE];
+  saidx_t high[MYBATCHSIZE];
+  saidx_t next[MYBATCHSIZE];
+  // Queries still being extended
+  int pending[MYBATCHSIZE];
+
+  for(int first=0; first<n; first+=MYBATCHSIZE)
   {
-    // We initialize the block value to the previous block
-    for(short a=0; a<_nchar; ++a)
-      _occ[a + ind*_nchar] = _occ[a + (ind-1)*_nchar];
+    int size = min(n-first, MYBATCHSIZE);
+    NucQuery ** group = queries+first;
+
+    int npending = 0;
+    for(int q=0; q<size; ++q)
+    {
+      low[q] = 0;
+      high[q] = 0;
+      next[q] = -1;
+
+      // The degenerate bases need a branching search
+      if(Nuc::degenerate(group[q]->sequence()))
+      {
+        search<false,true>(*group[q], pool, 0);
+        continue;
+      }
 
-    // We then add the characters occurrences between them
-    for(short a=0; a<_blocksize; ++a)
+      high[q] = _seqsize;
+      next[q] = group[q]->sequence().size()-1;
+
+      // The last characters are looked up in the table
+      next[q] -= kmerInterval(group[q]->sequence(), next[q], low[q], high[q]);
+
+      if(next[q] >= 0 && low[q] < high[q])
+        pending[npending++] = q;
+    }
+
+    // One character of each pending query per round
+    while(npending > 0)
     {
-      // Character in the BWT string
-      char c = _sequence[a + (ind-1)*_blocksize];
-      // Increment counter for this block
-      ++_occ[_nuc[c] + ind*_nchar];
+      int kept = 0;
+      for(int p=0; p<npending; ++p)
+      {
+        int q = pending[p];
+
+        // ith character in word, and its index
+        char c = group[q]->sequence()[next[q]];
+        short ic = Nuc::order(c);
+
+        // New low and high indexes
+        low[q] = _C[ic] + rank(c, low[q]);
+        high[q] = _C[ic] + rank(c, high[q]);
+        --next[q];
+
+        // The blocks of the next round are loaded while the other queries are extended
+        if(next[q] >= 0 && low[q] < high[q])
+        {
+          Nuc::prefetch(&_blocks[low[q]/MYBLOCKSIZE]);
+          Nuc::prefetch(&_blocks[high[q]/MYBLOCKSIZE]);
+          pending[kept++] = q;
+        }
+      }
+      npending = kept;
     }
+
+    // We store their positions
+    for(int q=0; q<size; ++q)
+      locate(*group[q], low[q], high[q]);
   }
 }
 
 
-void NucSequence::inverse_bwt()
+void NucSequence::mismatchBounds(const NucView & word, vector<int> & bound)
 {
-  // Bug correction : re-place end-character at the start of BWT
-  saidx_t end = 0;
-  while(_SA[end] != 0 && end < _seqsize)
-    ++end;
+  saidx_t size = word.size();
+  bound.resize(size);
 
-  for(saidx_t o=end; o>0; --o)
-    _sequence[o] = _sequence[o-1];
-  _sequence[0] = (char) 0;
-  // End correction
+  // Start of the shortest absent substring ending at the previous character
+  saidx_t start = 0;
 
-  if(_seqsize > 0)
+  for(saidx_t i=0; i<size; ++i)
   {
-    // WARNING : We use data contiguity in strings
-    sauchar_t * str = (sauchar_t *)&_sequence[0];
-    inverse_bw_transform(str, str, NULL, _seqsize, _pidx);
+    // We extend word[j..i] backwards until it is absent from the sequence
+    // (no need to go before the previous start : word[start..i] contains an absent substring)
+    saidx_t low = 0;
+    saidx_t high = _seqsize;
+    saidx_t j = i;
+    for(; j>=start && low < high; --j)
+    {
+      // A degenerate base can match : the substrings with it are not checked
+      if(Nuc::base(word[j]) < 0)
+        break;
+
+      short ic = Nuc::order(word[j]);
+      low = _C[ic] + rank(word[j], low);
+      high = _C[ic] + rank(word[j], high);
+    }
+
+    int previous = i > 0 ? bound[i-1] : 0;
+
+    if(low < high)
+      bound[i] = previous;
+    else
+    {
+      // word[j+1..i] is absent : one mismatch at least in it, plus the ones before
+      start = j+1;
+      bound[i] = max(previous, 1 + (start > 0 ? bound[start-1] : 0));
+    }
   }
+}
+
+
+void NucSequence::searchSchemes(NucQuery & query, NucPool & pool, int mismatches)
+{
+  static const char letters[6] = { 0, 'A', 'C', 'G', 'N', 'T' };
+
+  // Alias to the sequence we are looking for
+  const NucView & word = query.sequence();
+  // Size of the word
+  saidx_t size = word.size();
+
+  // The word is cut in mismatches+1 parts : part q is word[b[q]..b[q+1])
+  vector<int> & b = pool.bounds();
+  for(int q=0; q<=mismatches+1; ++q)
+    b.push_back(q*size/(mismatches+1));
 
-  _seqsize = _sequence.size()-1;
-  _sequence = _sequence.substr(0,_seqsize);
+  // Occurrences in the current interval, and before it
+  saidx_t before[6];
+  saidx_t occ[6];
 
-  _occ.clear();
-  _SA.clear();
+  vector<NucBiFrame> & stack = pool.biframes();
+
+  // Scheme p : part p is matched exactly, then extended to the right, then to the left.
+  // The parts before p need one mismatch at least, so each hit is only found by the
+  // scheme of its first exact part
+  for(int p=0; p<=mismatches; ++p)
+  {
+    NucBiFrame root = { (saidx_t)0, (saidx_t)0, _seqsize, b[p+1], b[p+1], 0, 0 };
+    stack.push_back(root);
+
+    while(!stack.empty())
+    {
+      NucBiFrame frame = stack.back();
+      stack.pop_back();
+
+      // The whole word is matched, we store the positions
+      if(frame.left == 0 && frame.right == size)
+      {
+        locate(query, frame.low, frame.low+frame.size);
+        continue;
+      }
+
+      // Part p first (exact), then the parts after it, then the ones before it
+      bool exact = frame.left > b[p];
+      bool leftward = exact || frame.right == size;
+
+      // Character to match, and its part when extending to the left after part p
+      saidx_t i = leftward ? frame.left-1 : frame.right;
+      int q = p-1;
+      while(!exact && leftward && b[q] > i)
+        --q;
+
+      // Left extensions read the BWT of the sequence, right extensions the one of the reversed sequence
+      if(leftward)
+        counts(_blocks, _end, frame.low, frame.size, before, occ);
+      else
+        counts(_revblocks, _revend, frame.revlow, frame.size, before, occ);
+
+      // Rows of the other interval skipped by the letters before x
+      saidx_t skipped = occ[0];
+      for(short x=1; x<6; skipped += occ[x], ++x)
+      {
+        if(occ[x] == 0)
+          continue;
+
+        int count = frame.count + (letters[x] != word[i] ? 1 : 0);
+        int mark = frame.mark;
+
+        if(exact)
+        {
+          if(count > 0)
+            continue;
+        }
+        else if(!leftward)
+        {
+          // The parts before p still need one mismatch each
+          if(count + p > mismatches)
+            continue;
+          mark = count;
+        }
+        else
+        {
+          // Part q is finished with this character : it needs a mismatch
+          bool finished = i == b[q];
+          if(finished && count == mark)
+            continue;
+          if(count + q + (!finished && count == mark ? 1 : 0) > mismatches)
+            continue;
+          if(finished)
+            mark = count;
+        }
+
+        NucBiFrame child = frame;
+        child.size = occ[x];
+        child.count = count;
+        child.mark = mark;
+        if(leftward)
+        {
+          child.low = _C[x] + before[x];
+          child.revlow = frame.revlow + skipped;
+          --child.left;
+        }
+        else
+        {
+          child.revlow = _C[x] + before[x];
+          child.low = frame.low + skipped;
+          ++child.right;
+        }
+
+        stack.push_back(child);
+      }
+    }
+  }
+}
+
+
+// Mismatch counting kernels of the sequential search : they stop once the limit is exceeded.
+// The word is padded (it can be read past its size), the text only up to avail characters
+namespace
+{
+  int hammingScalar(const char * word, const char * text, int size, int avail, int limit)
+  {
+    (void)avail;
+    int miss = 0;
+    for(int j=0; j<size && miss<=limit; ++j)
+      if(word[j] != text[j])
+        ++miss;
+    return miss;
+  }
+
+#ifdef __SSE2__
+  // 16 characters at a time
+  int hammingSSE2(const char * word, const char * text, int size, int avail, int limit)
+  {
+    int miss = 0;
+    for(int j=0; j<size && miss<=limit; j+=16)
+    {
+      // The last block would be read past the end of the text
+      if(j+16 > avail)
+        return miss + hammingScalar(word+j, text+j, size-j, avail-j, limit-miss);
+
+      __m128i a = _mm_loadu_si128((const __m128i *)(word+j));
+      __m128i b = _mm_loadu_si128((const __m128i *)(text+j));
+      uint64_t diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFF;
+      if(size-j < 16)
+        diff &= (((uint64_t)1) << (size-j)) - 1;
+      miss += Nuc::popcount(diff);
+    }
+    return miss;
+  }
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+  // 32 characters at a time (only called if the processor supports AVX2)
+  __attribute__((target("avx2")))
+  int hammingAVX2(const char * word, const char * text, int size, int avail, int limit)
+  {
+    int miss = 0;
+    for(int j=0; j<size && miss<=limit; j+=32)
+    {
+      if(j+32 > avail)
+        return miss + hammingSSE2(word+j, text+j, size-j, avail-j, limit-miss);
+
+      __m256i a = _mm256_loadu_si256((const __m256i *)(word+j));
+      __m256i b = _mm256_loadu_si256((const __m256i *)(text+j));
+      uint64_t diff = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) & 0xFFFFFFFFULL;
+      if(size-j < 32)
+        diff &= (((uint64_t)1) << (size-j)) - 1;
+      miss += Nuc::popcount(diff);
+    }
+    return miss;
+  }
+#endif
+
+  typedef int (*NucHamming)(const char *, const char *, int, int, int);
+
+  // Best kernel for the processor
+  NucHamming hammingKernel()
+  {
+#if defined(__GNUC__) && defined(__x86_64__)
+    if(__builtin_cpu_supports("avx2"))
+      return hammingAVX2;
+#endif
+#ifdef __SSE2__
+    return hammingSSE2;
+#else
+    return hammingScalar;
+#endif
+  }
+}
+
+
+void NucSequence::scanMismatches(NucQuery & query, int mismatches)
+{
+  static const NucHamming hamming = hammingKernel();
+
+  // Alias to the sequence we are looking for
+  const NucView & word = query.sequence();
+  // Size of the word
+  saidx_t size = word.size();
+  saidx_t seqsize = _sequence.size();
+  if(seqsize < size)
+    return;
+
+  const char * text = _sequence.data();
+
+  // Degenerate bases : the bases allowed at each character of the word are compared
+  // with the ones of the sequence (an N of the sequence matches nothing)
+  if(Nuc::degenerate(word))
+  {
+    vector<unsigned char> masks(size);
+    for(saidx_t j=0; j<size; ++j)
+      masks[j] = Nuc::mask(word[j]);
+
+    unsigned char bits[256] = { 0 };
+    bits[(unsigned char)'A'] = 1;
+    bits[(unsigned char)'C'] = 2;
+    bits[(unsigned char)'G'] = 4;
+    bits[(unsigned char)'T'] = 8;
+
+    for(saidx_t pos=0; pos <= seqsize-size; ++pos)
+    {
+      int miss = 0;
+      for(saidx_t j=0; j<size && miss<=mismatches; ++j)
+        if((masks[j] & bits[(unsigned char)text[pos+j]]) == 0)
+          ++miss;
+
+      if(miss <= mismatches)
+        query.addPosition(pos);
+    }
+    return;
+  }
+
+  // Padded copy of the word (the kernels read it by blocks)
+  string padded(word.data(), size);
+  padded.append(MYHAMMINGPAD, (char)0);
+
+  // For each position, we check the number of mismatches
+  for(saidx_t pos=0; pos <= seqsize-size; ++pos)
+    if(hamming(padded.data(), text+pos, size, seqsize-pos, mismatches) <= mismatches)
+      query.addPosition(pos);
 }
 
 
@@ -198,7 +1257,7 @@ NucSequences::NucSequences(string & filename)
     string name = "";
     string sense = "";
 
-    bool noend = getline(file, line);
+    bool noend = !getline(file, line).fail();
 
     //We check the first line (FASTA or TXT)
     if(line[0] == '>')
@@ -219,7 +1278,7 @@ NucSequences::NucSequences(string & filename)
 
           name = line.substr(startname,endname - startname);
 
-          noend = getline(file, line);
+          noend = !getline(file, line).fail();
         }
         else
           throw invalid_argument( "Unexpected format (FASTA file)." );
@@ -227,11 +1286,16 @@ NucSequences::NucSequences(string & filename)
         while(noend && line[0] != '>')
         {
           sense += line;
-          noend = getline(file, line);
+          noend = !getline(file, line).fail();
         }
 
         if(name != "" && sense != "")
+        {
           this->push_back(NucSequence(name,sense));
+
+          // The index is saved next to the FASTA file
+          this->back().indexname(filename + "." + this->back().name() + ".nbi");
+        }
         else
           throw invalid_argument( "Empty name or sequence (FASTA file)." );
 
@@ -248,3 +1312,123 @@ NucSequences::NucSequences(string & filename)
     }
   }
 }
+
+
+bool NucConcatenation::fits(NucSequences & sequences)
+{
+  // We sum in size_t, the total could overflow saidx_t
+  size_t total = 0;
+  for(NucSequences::iterator it=sequences.begin(); it!=sequences.end(); ++it)
+    total += it->sequence().size() + 1;
+  return total <= (size_t)numeric_limits<saidx_t>::max();
+}
+
+
+string NucConcatenation::concatenate(NucSequences & sequences)
+{
+  if(!fits(sequences))
+    throw invalid_argument( "The sequences are too long for a single index." );
+
+  string text;
+  for(NucSequences::iterator it=sequences.begin(); it!=sequences.end(); ++it)
+  {
+    if(it != sequences.begin())
+      text += 'N';
+    text += it->sequence();
+  }
+  return text;
+}
+
+
+NucConcatenation::NucConcatenation(NucSequences & sequences) :
+  NucSequence("concatenation", concatenate(sequences))
+{
+  // Start of each sequence (the separator counts as one character)
+  saidx_t start = 0;
+  for(NucSequences::iterator it=sequences.begin(); it!=sequences.end(); ++it)
+  {
+    _starts.push_back(start);
+    start += it->sequence().size() + 1;
+  }
+  _starts.push_back(start);
+
+  // Same sampling as the sequences, index saved next to the first one
+  if(!sequences.empty())
+  {
+    sampling(sequences.front().sampling());
+    bidirectional(sequences.front().bidirectional());
+
+    // (the tables of the sequences fit, the longest one does)
+    int size = 0;
+    for(NucSequences::iterator it=sequences.begin(); it!=sequences.end(); ++it)
+      size = max(size, it->kmers());
+    kmers(size);
+
+    string name = sequences.front().indexname();
+    if(name.size() > 4)
+    {
+      name.resize(name.size()-4);
+      ostringstream oss;
+      oss << name << ".all" << sequences.size() << ".nbi";
+      indexname(oss.str());
+    }
+  }
+}
+
+
+void NucConcatenation::split(NucQuery & query, vector<NucHit> & hits) const
+{
+  hits.clear();
+
+  int node = 0;
+  for(NucQuery * elt=&query; elt!=0; elt=elt->next, ++node)
+  {
+    saidx_t size = elt->sequence().size();
+    for(int k=0; k<elt->located(); ++k)
+    {
+      NucHit hit;
+      hit.node = node;
+      hit.pos = elt->position(k);
+      hit.seq = where(hit.pos, size);
+
+      // Hits over a separator are dropped
+      if(hit.seq >= 0)
+        hits.push_back(hit);
+    }
+  }
+
+  // Grouped by sequence (the order of the hits is kept inside each group)
+  stable_sort(hits.begin(), hits.end());
+}
+
+
+NucQuery * NucConcatenation::extract(NucQuery & query, const vector<NucHit> & hits, size_t begin, size_t end,
+                                     NucPool & pool, NucQuery *& last, bool windows)
+{
+  NucQuery * first = 0;
+  last = 0;
+
+  size_t h = begin;
+  int node = 0;
+  for(NucQuery * elt=&query; elt!=0; elt=elt->next, ++node)
+  {
+    if(node > 0 && !windows && (h == end || hits[h].node != node))
+      continue;
+
+    NucQuery * copy = pool.query();
+    copy->name(elt->name());
+    copy->sequence(elt->sequence());
+    copy->sense(elt->sense());
+
+    for(; h<end && hits[h].node == node; ++h)
+      copy->addPosition(hits[h].pos);
+
+    if(last == 0)
+      first = copy;
+    else
+      last->next = copy;
+    last = copy;
+  }
+
+  return first;
+}
@@ -8,14 +8,134 @@
 #include <divsufsort.h>
 #include <map>
 #include <list>
+#include <new>
+#include <cstdlib>
+#include <stdint.h>
+#include <limits>
+#include "nucview.hpp"
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 using namespace std;
 
-#define MYBLOCKSIZE 18
+// Number of BWT characters per rank block (one cache line, see NucRankBlock)
+#define MYBLOCKSIZE 128
+
+// Number of queries advanced together by the batched exact search
+#define MYBATCHSIZE 32
+
+// Longest k-mers of the lookup table (the intervals of all the k-mers up to 12 take 180 MB)
+#define MYMAXKMER 12
+
+// Path of the mismatch search which is not a k-mer of the lookup table
+#define MYNOKMER 0xFFFFFFFFu
+
+// Padding of the words compared by blocks (largest vector size)
+#define MYHAMMINGPAD 32
+
+// Index files (magic string and format version)
+#define NUCINDEX_MAGIC   "NUCBIDX"
+#define NUCINDEX_VERSION 7
 
 
 namespace Nuc {
     string complementary(const string & seq);
 
+    // Same, written in res (its buffer is reused)
+    void complementary(const NucView & seq, string & res);
+
+    // 64-bit FNV-1a hash, used to check that an index matches its sequence
+    uint64_t checksum(const string & seq);
+
+    // 2-bit code of a character in the packed BWT (N and the end character are exceptions)
+    inline uint64_t code(char c) { return c=='C' ? 1 : c=='G' ? 2 : c=='T' ? 3 : 0; }
+
+    // Same as index()[c], without the map lookup (used in the search loops)
+    inline short order(char c)
+    {
+        switch(c)
+        {
+          case 'A': return 1;
+          case 'C': return 2;
+          case 'G': return 3;
+          case 'N': return 4;
+          case 'T': return 5;
+          default : return 0;
+        }
+    }
+
+    // Index of A, C, G and T in the k-mers (-1 for the other characters)
+    inline int base(char c)
+    {
+        switch(c)
+        {
+          case 'A': return 0;
+          case 'C': return 1;
+          case 'G': return 2;
+          case 'T': return 3;
+          default : return -1;
+        }
+    }
+
+    // Bases allowed by an IUPAC code, one bit per base in the order of base() (0 if unknown)
+    inline int mask(char c)
+    {
+        switch(c)
+        {
+          case 'A': return 1;
+          case 'C': return 2;
+          case 'G': return 4;
+          case 'T': return 8;
+          case 'U': return 8;
+          case 'K': return 4|8;
+          case 'S': return 2|4;
+          case 'Y': return 2|8;
+          case 'M': return 1|2;
+          case 'W': return 1|8;
+          case 'R': return 1|4;
+          case 'B': return 2|4|8;
+          case 'D': return 1|4|8;
+          case 'H': return 1|2|8;
+          case 'V': return 1|2|4;
+          case 'N': return 1|2|4|8;
+          default : return 0;
+        }
+    }
+
+    // True if the character c of a sequence is allowed by the code w of a read
+    // (an N in the sequence is an unknown base, it matches nothing)
+    inline bool matches(char w, char c)
+    {
+        int x = base(c);
+        return x >= 0 && (mask(w) >> x & 1) != 0;
+    }
+
+    // True if the read has other characters than A, C, G and T (codes matching several bases)
+    bool degenerate(const NucView & word);
+
+    // Hint to load the cache line of p (no-op if the compiler has no prefetch builtin)
+    inline void prefetch(const void * p)
+    {
+    #ifdef __GNUC__
+        __builtin_prefetch(p);
+    #else
+        (void)p;
+    #endif
+    }
+
+    // Number of bits set in a word
+    inline int popcount(uint64_t x)
+    {
+    #ifdef __GNUC__
+        return __builtin_popcountll(x);
+    #else
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        return (int)((x * 0x0101010101010101ULL) >> 56);
+    #endif
+    }
+
     inline map<char,unsigned char> index()
     {
         map<char,unsigned char> res;
@@ -30,44 +150,234 @@ namespace Nuc {
 }
 
 
+// One cache line of the index : the occurrences of A, C, G and T before the block,
+// then MYBLOCKSIZE BWT characters packed on 2 bits and the bit vector of their exceptions
+// (N and the end character, coded as A). The N occurrences are deduced from the others.
+struct NucRankBlock
+{
+    uint32_t occ[4];
+    uint64_t bwt[MYBLOCKSIZE/32];
+    uint64_t except[MYBLOCKSIZE/64];
+};
+
+
+// Allocator for the rank blocks, so each block sits on a single cache line
+template <class T>
+class NucAlignedAllocator
+{
+  public:
+    typedef T         value_type;
+    typedef T *       pointer;
+    typedef const T * const_pointer;
+    typedef T &       reference;
+    typedef const T & const_reference;
+    typedef size_t    size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U> struct rebind { typedef NucAlignedAllocator<U> other; };
+
+    NucAlignedAllocator() {}
+    template <class U> NucAlignedAllocator(const NucAlignedAllocator<U> &) {}
+
+    pointer       address(reference x) const       { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+    size_type     max_size() const                 { return size_t(-1) / sizeof(T); }
+
+    void construct(pointer p, const T & val) { new((void *)p) T(val); }
+    void destroy(pointer p)                  { p->~T(); }
+
+    pointer allocate(size_type n, const void * = 0)
+    {
+      void * p = 0;
+    #ifdef _WIN32
+      p = _aligned_malloc(n*sizeof(T), 64);
+    #else
+      if(posix_memalign(&p, 64, n*sizeof(T)) != 0)
+        p = 0;
+    #endif
+      if(p == 0 && n > 0)
+        throw bad_alloc();
+      return (pointer)p;
+    }
+
+    void deallocate(pointer p, size_type)
+    {
+    #ifdef _WIN32
+      _aligned_free(p);
+    #else
+      free(p);
+    #endif
+    }
+};
+
+template <class T, class U>
+bool operator==(const NucAlignedAllocator<T> &, const NucAlignedAllocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const NucAlignedAllocator<T> &, const NucAlignedAllocator<U> &) { return false; }
+
+// Rank blocks of a packed BWT
+typedef vector<NucRankBlock, NucAlignedAllocator<NucRankBlock> > NucBlocks;
+
+
 // Class for queries
 class NucQuery
 {
   protected:
-    string _name;
-    string _sequence;
-    bool   _sense;
+    NucView _name;
+    NucView _sequence;
+    string  _storage;   // Sequence text when it is built (and not a view)
+    bool    _sense;
     vector<saidx_t> _positions;
+    int     _limit;     // Positions stored at most (all of them if negative)
+    int     _unlocated; // Occurrences counted over the limit (without their positions)
 
   public:
     // Only used when looking for submatches using a linked list
+    // (the nodes belong to a NucPool)
     NucQuery * next;
 
   public:
     // Constructor
-    NucQuery() : next(0) {}
-
-    // Destructor
-    ~NucQuery();
+    NucQuery() : _sense(true), _limit(-1), _unlocated(0), next(0) {}
 
     // Getters
-    inline const string & name()     { return _name;             }
-    inline const string & sequence() { return _sequence;         }
-    inline const bool   & sense()    { return _sense;            }
-    inline       int      count()    { return _positions.size(); }
+    inline const NucView & name()     { return _name;             }
+    inline const NucView & sequence() { return _sequence;         }
+    inline const bool    & sense()    { return _sense;            }
+    inline       int       count()    { return _positions.size() + _unlocated; }
+    inline       int       located()  { return _positions.size(); }
+
+    // Setters (the name and the sequence are views, their text must outlive the query)
+    inline void name    ( const NucView& name )      { _name = name;         }
+    inline void sequence( const NucView& sequence )  { _sequence = sequence; }
+    inline void sense   ( const bool& sense )        { _sense = sense;       }
+    inline void limit   ( const int& limit )         { _limit = limit;       }
+
+    // Sequence made of c followed by seq (kept by the query)
+    inline void sequence( char c, const NucView& seq )
+    {
+      _storage.assign(1, c);
+      _storage.append(seq.data(), seq.size());
+      _sequence = NucView(_storage);
+    }
 
-    // Setters
-    inline void name    ( const string& name )      { _name = name;         }
-    inline void sequence( const string& sequence )  { _sequence = sequence; }
-    inline void sense   ( const bool& sense )       { _sense = sense;       }
+    // Sequence made of the reverse complement of seq (kept by the query)
+    inline void complementary( const NucView& seq )
+    {
+      Nuc::complementary(seq, _storage);
+      _sequence = NucView(_storage);
+    }
+
+    // Back to an empty query (the buffers are kept)
+    inline void clear() { _name = NucView(); _sequence = NucView(); _sense = true; _positions.clear();
+                        _limit = -1; _unlocated = 0; next = 0; }
 
-    // Positions handling
-    inline void    addPosition(saidx_t pos)    { _positions.push_back(pos);                }
+    // True when the limit is reached : the next occurrences are only counted
+    inline bool full() { return _limit >= 0 && (int)_positions.size() >= _limit; }
+
+    // Positions handling (over the limit, the occurrences are only counted)
+    inline void    addHits(saidx_t n)          { _unlocated += n;                          }
+    inline void    addPosition(saidx_t pos)    { if(full()) ++_unlocated; else _positions.push_back(pos); }
     inline void    removePosition(saidx_t pos) { _positions.erase(_positions.begin()+pos); }
     inline saidx_t position(int k)             { return _positions[k];                     }
 };
 
 
+// Pending interval of the backtracking mismatch search
+struct NucFrame
+{
+    saidx_t low;
+    saidx_t high;
+    saidx_t i;      // Next character of the word to match (backwards)
+    int     count;  // Mismatches so far
+    uint32_t code;  // Characters matched so far, as a k-mer (MYNOKMER if there is an N)
+};
+
+
+// Maximal match candidate : word[start..start+size) at the rows [low,high) of the suffix
+// array, the rows [extlow,exthigh) being the ones extended by the next character of the word
+// (the sequential search gives one position, in low)
+struct NucMatch
+{
+    saidx_t start;
+    saidx_t size;
+    saidx_t low;
+    saidx_t high;
+    saidx_t extlow;
+    saidx_t exthigh;
+
+    // By increasing size, then decreasing start
+    bool operator<(const NucMatch & match) const
+    {
+      return size < match.size || (size == match.size && start > match.start);
+    }
+};
+
+
+// Pending interval of the bidirectional search : word[left..right) is matched,
+// low in the suffix array of the sequence, revlow in the one of the reversed sequence
+struct NucBiFrame
+{
+    saidx_t low;
+    saidx_t revlow;
+    saidx_t size;
+    saidx_t left;
+    saidx_t right;
+    int     count;  // Mismatches so far
+    int     mark;   // Mismatches when the current part was started (left extension)
+};
+
+
+// Per-thread pool of queries (submatch fragments) and search buffers : it is reset
+// for each read (or batch of reads) and its nodes (with their buffers) are reused, so searching does
+// not go through malloc once the pool is warm
+class NucPool
+{
+  protected:
+    vector<NucQuery *> _queries;
+    size_t             _used;   // Queries given since the last reset
+    vector<NucFrame>   _frames; // Stack of the mismatch search
+    vector<NucBiFrame> _biframes; // Stack of the bidirectional search
+    vector<int>        _bounds; // Lower bounds of the mismatches (mismatch search)
+    vector<int>        _indices[2]; // Scratch vectors (submatch merging)
+    vector<saidx_t>    _intervals; // Intervals of the substrings ending at one position (maximal matches)
+    vector<NucMatch>   _matches;   // Maximal match candidates of a word
+
+  private:
+    NucPool(const NucPool &);
+    NucPool & operator=(const NucPool &);
+
+  public:
+    // Constructor and destructor
+    NucPool() : _used(0) {}
+    ~NucPool();
+
+    // Gives an empty query (valid until the next reset)
+    inline NucQuery * query()
+    {
+      if(_used == _queries.size())
+        _queries.push_back(new NucQuery);
+
+      NucQuery * query = _queries[_used++];
+      query->clear();
+      return query;
+    }
+
+    // Search buffers (emptied)
+    inline vector<NucFrame> & frames() { _frames.clear(); return _frames; }
+    inline vector<NucBiFrame> & biframes() { _biframes.clear(); return _biframes; }
+    inline vector<int> & bounds() { _bounds.clear(); return _bounds; }
+
+    // Scratch vector (emptied)
+    inline vector<int> & indices(int k) { _indices[k].clear(); return _indices[k]; }
+    inline vector<saidx_t> & intervals() { _intervals.clear(); return _intervals; }
+    inline vector<NucMatch> & matches() { _matches.clear(); return _matches; }
+
+    // All the queries are given back
+    inline void reset() { _used = 0; }
+};
+
+
 class NucSequence
 {
   protected:
@@ -79,10 +389,19 @@ class NucSequence
     short _nchar;
     saidx_t _seqsize;
     vector<saidx_t> _C;
-    vector<saidx_t> _SA;
-    vector<saidx_t> _occ; // Used as 2D vector, but cleaner with 1D-vector
-    short _blocksize;
-    saidx_t _pidx;
+    vector<saidx_t> _SA;  // Full, or only the sampled values if _sarate > 1
+    NucBlocks _blocks;    // Packed BWT and occurrences
+    saidx_t _end;         // Row of the end character in the BWT
+    NucBlocks _revblocks; // Same for the reversed sequence (bidirectional search only)
+    saidx_t _revend;
+    int _sarate;          // Suffix array sampling rate (1 = full suffix array)
+    bool _bidirectional;  // Builds the reversed index (mismatches searched with search schemes)
+    int _kmersize;        // Longest k-mers of the lookup table (0 = no table)
+    int _kmerdepth;       // Same for the table in memory
+    vector<saidx_t> _kmers;       // Interval (low, high) of every k-mer of 1 to _kmerdepth characters
+    vector<uint64_t> _sampled;    // Bit vector of the rows kept in _SA
+    vector<saidx_t> _sampledrank; // Number of sampled rows before each word of _sampled
+    string _indexname; // Index file (empty if the index is not saved)
 
   // No default constructor (no empty object)
   private:
@@ -94,7 +413,7 @@ class NucSequence
 
     NucSequence(string name, string sequence) :
       _name(name), _sequence(sequence), _nuc(Nuc::index()), _nchar(_nuc.size()), _C(_nchar),
-      _blocksize(MYBLOCKSIZE)
+      _sarate(1), _bidirectional(false), _kmersize(0), _kmerdepth(0)
     {
       lowercasename();
       if(!check()) throw invalid_argument( "Invalid characters in the sequence." );
@@ -111,25 +430,245 @@ class NucSequence
     // Const Getters
     const string & name()          { return _name;         }
     const string & sequence()      { return _sequence;     }
+    const string & indexname()     { return _indexname;    }
+    int            sampling()      { return _sarate;       }
+    bool           bidirectional() { return _bidirectional; }
+    int            kmers()         { return _kmersize;     }
 
     // Setters
     void name(const string & name) { _name = name; }
-
-    // BWT
+    void indexname(const string & indexname) { _indexname = indexname; }
+    // Keeps one suffix array value every "rate" positions (less memory, slower locate)
+    void sampling(int rate) { _sarate = max(rate, 1); }
+    // Also indexes the reversed sequence (faster searches with mismatches, more memory)
+    void bidirectional(bool bidirectional) { _bidirectional = bidirectional; }
+    // Table of the intervals of the k-mers up to this size, the searches start from it
+    // (at most log4 of the sequence size, the longer k-mers are almost all absent)
+    void kmers(int size);
+
+    // Longest k-mers for which the lookup tables of all the sequences fit together in memory
+    // (in bytes), set on each of them
+    static void kmers(vector<NucSequence> & sequences, double memory);
+
+    // BWT (builds or loads the index, then releases it, the sequence is untouched)
     void bwt();
     void inverse_bwt();
 
     template <bool SUBMATCHES,bool MISMATCHES, bool BWT>
-    void search(NucQuery & query, const int & mismatches, const int & submatches);
+    void search(NucQuery & query, NucPool & pool, const int & mismatches, const int & submatches);
 
     template <bool MISMATCHES, bool BWT>
-    void search(NucQuery & query, const int & mismatches);
+    void search(NucQuery & query, NucPool & pool, const int & mismatches);
+
+    // Exact search of n queries with the index, advanced in lock-step : the rank blocks
+    // of the next step are prefetched, so the memory accesses of the queries overlap
+    // (the degenerate queries are searched one by one)
+    void search(NucQuery ** queries, int n, NucPool & pool);
+
+    // Searches the fragments of the query (linked after it), returns the last one (0 if none)
+    template <bool MISMATCHES, bool BWT>
+    NucQuery * fragments(NucQuery & query, NucPool & pool, const int & mismatches, const int & submatches);
+
+    // Merges the adjacent fragments and removes the ones without hits
+    static void merge(NucQuery & query, NucQuery * last, NucPool & pool);
+
+    // Fragments of exact searches with the index, instead of fragments then merge : the
+    // maximal matches of submatches characters at least (the occurrences extended neither
+    // by the previous nor by the next character of the word), found in one pass over the
+    // ends of the word (returns the last fragment, 0 if none). There is no suffix tree to
+    // shorten a match, so each end has its own backward search, stopped where its interval
+    // is the one of the next end : about log4(sequence size) steps per end for a read at one
+    // locus, up to size^2/2 for low-complexity reads in repeats
+    NucQuery * maximalMatches(NucQuery & query, NucPool & pool, int submatches);
+
+    // Same maximal matches for the sequential search, from the hits of the windows of
+    // fragments (each one not extended by the previous character is extended in the text)
+    void windowMatches(NucQuery & query, NucPool & pool);
+
+    // True if the fragments of the query are maximal matches (exact search of the bases only),
+    // else the windows are merged
+    template <bool MISMATCHES>
+    static inline bool maximal(NucQuery & query) { return !MISMATCHES && !Nuc::degenerate(query.sequence()); }
+
+    // Fragments of the query, merged (with the fastest method for the options)
+    template <bool MISMATCHES, bool BWT>
+    void findFragments(NucQuery & query, NucPool & pool, const int & mismatches, const int & submatches);
 
   protected:
+    // Occurrences of c in the BWT before row i
+    inline saidx_t rank(char c, saidx_t i) { return rank(_blocks, _end, c, i); }
+
+    // Same in any packed BWT (forward or reversed)
+    static inline saidx_t rank(const NucBlocks & blocks, saidx_t end, char c, saidx_t i)
+    {
+      if(c == 0)
+        return end < i ? 1 : 0;
+
+      // Block (a single cache line) and remaining characters to count in it
+      saidx_t b = i/MYBLOCKSIZE;
+      const NucRankBlock & block = blocks[b];
+      short modb = i%MYBLOCKSIZE;
+
+      // Exceptions in the block before row i (and the end character if it is one of them)
+      int except = Nuc::popcount(block.except[0] & lowmask(modb));
+      if(modb > 64)
+        except += Nuc::popcount(block.except[1] & lowmask(modb-64));
+
+      if(c == 'N')
+      {
+        // Everything which is not A, C, G, T or the end character is N
+        saidx_t start = b*MYBLOCKSIZE;
+        saidx_t occ = start - block.occ[0] - block.occ[1] - block.occ[2] - block.occ[3];
+        if(end < start)
+          --occ;
+        if(end >= start && end < i)
+          --except;
+        return occ + except;
+      }
+
+      // Counting remaining characters in the packed BWT
+      uint64_t x = Nuc::code(c);
+      saidx_t occ = block.occ[x];
+      for(short w=0; 32*w < modb; ++w)
+        occ += countCode(block.bwt[w], x, modb-32*w);
+
+      // Exceptions are coded as A
+      if(x == 0)
+        occ -= except;
+
+      return occ;
+    }
+
+    // Mask of the n lowest bits (all bits for n >= 64)
+    static inline uint64_t lowmask(short n)
+    {
+      return n >= 64 ? ~(uint64_t)0 : (((uint64_t)1) << n) - 1;
+    }
+
+    // Number of characters of code x in the n first characters of a packed word
+    static inline int countCode(uint64_t word, uint64_t x, short n)
+    {
+      word ^= x * 0x5555555555555555ULL;
+      uint64_t match = ~(word | (word >> 1)) & 0x5555555555555555ULL;
+      if(n < 32)
+        match &= (((uint64_t)1) << (2*n)) - 1;
+      return Nuc::popcount(match);
+    }
+
+    // BWT character at row k
+    inline char bwtchar(saidx_t k)
+    {
+      const NucRankBlock & block = _blocks[k/MYBLOCKSIZE];
+      short modb = k%MYBLOCKSIZE;
+
+      if(block.except[modb/64] >> (modb%64) & 1)
+        return k == _end ? (char)0 : 'N';
+
+      static const char letters[4] = { 'A', 'C', 'G', 'T' };
+      return letters[block.bwt[modb/32] >> (2*(modb%32)) & 3];
+    }
+
+    // Occurrences of the end character, A, C, G, N and T in rows [low,low+size) of a packed BWT,
+    // and before them
+    static inline void counts(const NucBlocks & blocks, saidx_t end, saidx_t low, saidx_t size,
+                              saidx_t before[6], saidx_t occ[6])
+    {
+      static const char letters[6] = { 0, 'A', 'C', 'G', 'N', 'T' };
+      for(int x=0; x<6; ++x)
+      {
+        before[x] = rank(blocks, end, letters[x], low);
+        occ[x] = rank(blocks, end, letters[x], low+size) - before[x];
+      }
+    }
+
+    // First entry of the k-mers of d characters in the lookup table
+    static inline uint32_t kmerOffset(int d) { return ((((uint32_t)1) << (2*d)) - 4)/3; }
+
+    // Interval of the longest k-mer of A, C, G and T ending at word[i] in the lookup table :
+    // returns its size (0 if there is none)
+    inline int kmerInterval(const NucView & word, saidx_t i, saidx_t & low, saidx_t & high)
+    {
+      uint32_t code = 0;
+      int d = 0;
+      for(; d<_kmerdepth && d<=i; ++d)
+      {
+        int x = Nuc::base(word[i-d]);
+        if(x < 0)
+          break;
+        code += ((uint32_t)x) << (2*d);
+      }
+
+      if(d > 0)
+      {
+        low = _kmers[2*(kmerOffset(d)+code)];
+        high = _kmers[2*(kmerOffset(d)+code)+1];
+      }
+      return d;
+    }
+
+    // Search schemes over the bidirectional index (pigeonhole : one part of the word
+    // is matched exactly first, then extended on both sides with the mismatches)
+    void searchSchemes(NucQuery & query, NucPool & pool, int mismatches);
+
+    // Sequential search with mismatches (vectorized comparison of the word with each window,
+    // bitmasks of the allowed bases for the degenerate words)
+    void scanMismatches(NucQuery & query, int mismatches);
+
+    // Lower bounds of the mismatches needed by the prefixes of word (BWA's D array) :
+    // word[j..i] being the shortest absent substring ending at i, bound[i] = max(bound[i-1], 1 + bound[j-1])
+    void mismatchBounds(const NucView & word, vector<int> & bound);
+
+    // Position in the sequence of the suffix at row k (LF-walk to a sampled row)
+    inline saidx_t locate(saidx_t k)
+    {
+      if(_sarate == 1)
+        return _SA[k];
+
+      saidx_t steps = 0;
+      while(!(_sampled[k/64] >> (k%64) & 1))
+      {
+        char c = bwtchar(k);
+        k = _C[Nuc::order(c)] + rank(c, k);
+        ++steps;
+      }
+
+      uint64_t before = _sampled[k/64] & ((((uint64_t)1) << (k%64)) - 1);
+      return _SA[_sampledrank[k/64] + Nuc::popcount(before)] + steps;
+    }
+
+    // Stores the positions of the rows [low,high) until the query is full, the others are only counted
+    inline void locate(NucQuery & query, saidx_t low, saidx_t high)
+    {
+      for(saidx_t k=low; k<high; ++k)
+      {
+        if(query.full())
+        {
+          query.addHits(high-k);
+          return;
+        }
+        query.addPosition(locate(k));
+      }
+    }
+
     // Puts the name in lower case
     void lowercasename() { transform(_name.begin(), _name.end(), _name.begin(), (int (*)(int))tolower); }
     // Checks the sequence
     bool check();
+
+    // Packed BWT of a text (ending with the end character) read from its suffix array
+    static void buildBlocks(const string & text, const saidx_t * SA, saidx_t size, NucBlocks & blocks, saidx_t & end);
+
+    // Index of the reversed sequence
+    void reverseIndex();
+
+    // Lookup table of the k-mers (all the intervals found by backward search from the k-mers
+    // of d characters, code being the one of the current one)
+    void kmerTable();
+    void kmerTable(int d, uint32_t code, saidx_t low, saidx_t high);
+
+    // Index files (load returns false if the file is missing or outdated)
+    bool loadIndex(uint64_t checksum);
+    void saveIndex(uint64_t checksum);
 };
 
 
@@ -142,16 +681,55 @@ class NucSequences : public vector<NucSequence>
 };
 
 
-struct Candidates
+// Hit found in a concatenation : sequence, query node (0 for the query, then its
+// fragments) and position in the sequence
+struct NucHit
 {
-    int count;
-    saidx_t low;
-    saidx_t high;
-    Candidates(int c, saidx_t l, saidx_t h, Candidates * n) : count(c), low(l), high(h), next(n) {}
+    int     seq;
+    int     node;
+    saidx_t pos;
 
-    Candidates * next;
+    bool operator<(const NucHit & hit) const { return seq < hit.seq; }
 };
 
+
+// All the sequences in a single FM-index : they are concatenated with 'N' separators,
+// so one backward search finds the hits in every sequence, which are then mapped back
+class NucConcatenation : public NucSequence
+{
+  protected:
+    vector<saidx_t> _starts;   // Start of each sequence in the concatenation (plus the end)
+
+    // Concatenated text
+    static string concatenate(NucSequences & sequences);
+
+  public:
+    NucConcatenation(NucSequences & sequences);
+
+    // True if the sequences and their separators fit in one index (positions are saidx_t)
+    static bool fits(NucSequences & sequences);
+
+    // Sequence containing the hit (-1 if it spans a separator), pos becomes relative to it
+    inline int where(saidx_t & pos, saidx_t size) const
+    {
+      int s = upper_bound(_starts.begin(), _starts.end(), pos) - _starts.begin() - 1;
+      if(pos + size >= _starts[s+1])
+        return -1;
+
+      pos -= _starts[s];
+      return s;
+    }
+
+    // Hits of the query and its fragments, sorted by sequence
+    void split(NucQuery & query, vector<NucHit> & hits) const;
+
+    // Copy of the query and its fragments with the hits [begin,end) of one sequence (the
+    // fragments without hits are kept for merge only, the windows must stay adjacent)
+    static NucQuery * extract(NucQuery & query, const vector<NucHit> & hits, size_t begin, size_t end,
+                              NucPool & pool, NucQuery *& last, bool windows);
+};
+
+
 #include "nucsequences.hxx"
 
 #endif
@@ -5,285 +5,193 @@
 
 
 template <bool SUBMATCHES, bool MISMATCHES, bool BWT>
-void NucSequence::search(NucQuery & query, const int & mismatches, const int & submatches)
+void NucSequence::search(NucQuery & query, NucPool & pool, const int & mismatches, const int & submatches)
 {
-  // Alias to the sequence we are looking for
-  const string & word = query.sequence();
-  // Size of the word
-  saidx_t size = word.size();
-
-  search<MISMATCHES,BWT>(query,mismatches);
+  search<MISMATCHES,BWT>(query,pool,mismatches);
 
   if(SUBMATCHES)
+    findFragments<MISMATCHES,BWT>(query,pool,mismatches,submatches);
+}
+
+
+template <bool MISMATCHES, bool BWT>
+void NucSequence::findFragments(NucQuery & query, NucPool & pool, const int & mismatches, const int & submatches)
+{
+  if(BWT && maximal<MISMATCHES>(query))
+    maximalMatches(query,pool,submatches);
+  else
   {
-    if(size >= submatches)
+    NucQuery * last = fragments<MISMATCHES,BWT>(query,pool,mismatches,submatches);
+
+    if(last != 0)
     {
-      NucQuery * last = &query;
+      if(maximal<MISMATCHES>(query))
+        windowMatches(query,pool);
+      else
+        merge(query,last,pool);
+    }
+  }
+}
 
-      for(int i=size-submatches; i>=0; --i)
-      {
-        last->next = new NucQuery;
 
-        NucQuery * elt = last->next;
-        elt->name(query.name());
-        elt->sequence(word.substr(i, submatches));
-        elt->sense(query.sense());
+template <bool MISMATCHES, bool BWT>
+NucQuery * NucSequence::fragments(NucQuery & query, NucPool & pool, const int & mismatches, const int & submatches)
+{
+  // Alias to the sequence we are looking for
+  const NucView & word = query.sequence();
+  // Size of the word
+  saidx_t size = word.size();
 
-        search<MISMATCHES,BWT>(*elt,mismatches);
+  if(size < submatches)
+    return 0;
 
-        last = elt;
-      }
+  NucQuery * last = &query;
 
-      last->next = 0;
+  for(int i=size-submatches; i>=0; --i)
+  {
+    last->next = pool.query();
 
-      // We merge adjacent submatches
-      NucQuery * elt = query.next;
-      NucQuery * nxt = elt->next;
-      while(nxt != 0)
-      {
-        string str1(elt->sequence(),0,elt->sequence().size()-1);
-        string str2(nxt->sequence(),1,nxt->sequence().size()-1);
+    NucQuery * elt = last->next;
+    elt->name(query.name());
+    elt->sequence(word.substr(i, submatches));
+    elt->sense(query.sense());
 
-        NucQuery * lastprev = last;
-        if(str1 == str2)
-        {
-          vector<int> ind;
-          for(int i=0;i<elt->count(); ++i)
-            for(int j=0;j<nxt->count(); ++j)
-              if(elt->position(i) == (nxt->position(j)+1))
-                ind.push_back(i);
+    search<MISMATCHES,BWT>(*elt,pool,mismatches);
 
-          if(ind.size() > 0)
-          {
-            string tmp(nxt->sequence(),0,1);
-            tmp += elt->sequence();
-
-            last->next = new NucQuery;
-            last = last->next;
-
-            last->name(query.name());
-            last->sequence(tmp);
-            last->sense(query.sense());
-            last->next = 0;
-
-            for(int i=ind.size()-1;i>=0; --i)
-            {
-              last->addPosition(elt->position(ind[i])-1);
-              elt->removePosition(ind[i]);
-            }
-          }
-        }
+    last = elt;
+  }
 
-        if(str1 == str2 || elt->sequence().size() < nxt->sequence().size())
-        {
-          vector<int> ind2rm;
-          for(int i=0;i<elt->count(); ++i)
-            for(int j=0;j<lastprev->count(); ++j)
-              if(elt->position(i) == lastprev->position(j))
-                ind2rm.push_back(i);
-
-          for(int i=ind2rm.size()-1;i>=0; --i)
-            elt->removePosition(ind2rm[i]);
-        }
-        elt = nxt;
-        nxt = elt->next;
-      }
+  last->next = 0;
 
-      // List cleaning
-      elt = &query;
-      nxt = elt->next;
-      while(nxt != last)
-      {
-        if(nxt->count() == 0)
-        {
-          elt->next = nxt->next;
-          nxt->next = 0;
-          delete nxt;
-        }
-        else
-          elt = nxt;
-        nxt = elt->next;
-      }
-      if(last->sequence() == query.sequence() || last->count() == 0)
-      {
-        elt->next = 0;
-        delete last;
-      }
-    }
-  }
+  return last;
 }
 
 
 template <bool MISMATCHES, bool BWT>
-void NucSequence::search(NucQuery & query, const int & mismatches)
+void NucSequence::search(NucQuery & query, NucPool & pool, const int & mismatches)
 {
   // Alias to the sequence we are looking for
-  const string & word = query.sequence();
+  const NucView & word = query.sequence();
   // Size of the word
   saidx_t size = word.size();
+  // Degenerate bases (IUPAC codes) : the search branches over the bases they allow
+  bool degenerate = Nuc::degenerate(word);
 
   if(BWT)
   {
-    if(!MISMATCHES)
+    if(!MISMATCHES && !degenerate)
     {
       // We initialize the loop variables
       // Low index
       saidx_t low = 0;
       // High index
-      saidx_t high = _seqsize+1;
+      saidx_t high = _seqsize;
+
+      // The last characters are looked up in the table
+      saidx_t last = size-1 - kmerInterval(word, size-1, low, high);
 
       // We search for character in ith position
       // with consideration to the previous character treated
-      for(saidx_t i=size-1; i>=0 && low < high; --i)
+      for(saidx_t i=last; i>=0 && low < high; --i)
       {
         // ith character in word
         char c = word[i];
         // Corresponding index
-        short ic = _nuc[c];
-
-        // Occurrences (table divided in blocks)
-        // Blocks indexes
-        saidx_t lowb = low/_blocksize;
-        saidx_t highb = high/_blocksize;
-
-        // Blocks values
-        saidx_t lowocc = _occ[ic+lowb*_nchar];
-        saidx_t highocc = _occ[ic+highb*_nchar];
-
-        // Remaining characters to browse in BWT
-        short lowmodb = low%_blocksize;
-        short highmodb = high%_blocksize;
-
-        // Counting remaining characters in BWT (low)
-        for(short a=0; a<lowmodb; ++a)
-          if(_sequence[a+lowb*_blocksize] == c)
-            ++lowocc;
-
-        // Counting remaining characters in BWT (high)
-        for(short a=0; a<highmodb; ++a)
-          if(_sequence[a+highb*_blocksize] == c)
-            ++highocc;
+        short ic = Nuc::order(c);
 
         // New low and high indexes
-        low = _C[ic] + lowocc;
-        high = _C[ic] + highocc;
+        low = _C[ic] + rank(c, low);
+        high = _C[ic] + rank(c, high);
       }
 
       // We store their positions
-      for(saidx_t k=low; k<high; ++k)
-        query.addPosition(_SA[k]);
+      locate(query, low, high);
+    }
+    else if(MISMATCHES && !degenerate && _bidirectional && size >= 2*(mismatches+1))
+    {
+      // Search schemes over the bidirectional index (parts of two characters at least)
+      searchSchemes(query,pool,mismatches);
     }
     else
     {
-      // We initialize the loop variables
-      // Character being treated
-      saidx_t i = size-1;
+      // Depth-first backtracking over a stack, pruned with the lower bounds
+      // of the mismatches still needed by the rest of the word
+      static const char letters[5] = { 'A', 'C', 'G', 'N', 'T' };
 
-      //list<Candidate> candidates;
-      //candidates.push_front(Candidate(0,0,_seqsize+1));
-      Candidates * init = 0;
-      Candidates * lst = new Candidates(0,(saidx_t)0,_seqsize+1,init);
+      // Exact search of a degenerate word : only the allowed bases are followed
+      int allowed = MISMATCHES ? mismatches : 0;
 
-      // We search for character in ith position
-      // with consideration to the previous character treated
-      while(lst != 0 && i >= 0)
+      vector<int> & bound = pool.bounds();
+      mismatchBounds(word, bound);
+
+      vector<NucFrame> & stack = pool.frames();
+      if(size == 0 || bound[size-1] <= allowed)
       {
-        Candidates * ptr = lst;
-        Candidates ** prev = &lst;
+        NucFrame root = { (saidx_t)0, _seqsize, size-1, 0, 0 };
+        stack.push_back(root);
+      }
 
-        while(ptr != 0)
+      while(!stack.empty())
+      {
+        NucFrame frame = stack.back();
+        stack.pop_back();
+
+        // The whole word is matched, we store the positions
+        if(frame.i < 0)
         {
-          // We get the candidate triplet
-          int count = ptr->count;
-          saidx_t clow = ptr->low;
-          saidx_t chigh = ptr->high;
-
-          // Map iteration
-          map<char,unsigned char>::iterator it = _nuc.begin();
-          ++it;
-          while(it!=_nuc.end())
-          {
-            char c = it->first;
-            char ic = it->second;
-
-            // Local low & high
-            saidx_t high = chigh;
-            saidx_t low = clow;
-
-            // Occurrences (table divided in blocks)
-            // Blocks indexes
-            saidx_t lowb = low/_blocksize;
-            saidx_t highb = high/_blocksize;
-
-            // Blocks values
-            saidx_t lowocc = _occ[ic+lowb*_nchar];
-            saidx_t highocc = _occ[ic+highb*_nchar];
-
-            // Remaining characters to browse in BWT
-            short lowmodb = low%_blocksize;
-            short highmodb = high%_blocksize;
-
-            // Counting remaining characters in BWT (low)
-            for(short a=0; a<lowmodb; ++a)
-              if(_sequence[a+lowb*_blocksize] == c)
-                ++lowocc;
-
-            // Counting remaining characters in BWT (high)
-            for(short a=0; a<highmodb; ++a)
-              if(_sequence[a+highb*_blocksize] == c)
-                ++highocc;
-
-            // New low and high indexes
-            low = _C[ic] + lowocc;
-            high = _C[ic] + highocc;
-
-            if(c != word[i] && low < high && count<mismatches)
-            {
-              lst = new Candidates(count+1,low,high,lst);
-              if(lst->next == ptr)
-                prev = &(lst->next);
-            }
-            else if(c == word[i] && low < high)
-            {
-              lst = new Candidates(count,low,high,lst);
-              if(lst->next == ptr)
-                prev = &(lst->next);
-            }
-
-            ++it;
-          }
+          locate(query, frame.low, frame.high);
+          continue;
+        }
 
-          *prev = ptr->next;
+        // Mismatches needed before the ith character
+        int before = frame.i > 0 ? bound[frame.i-1] : 0;
 
-          delete ptr;
-          ptr = *prev;
-        }
+        // Characters matched so far : the first ones are looked up in the table
+        int depth = size-1 - frame.i;
+        bool table = frame.code != MYNOKMER && depth < _kmerdepth;
 
-        // Previous character
-        --i;
-      }
+        // Children are pushed so that the hits come in the same order as
+        // the former breadth-first search (the direction alternates with i)
+        for(int n=0; n<5; ++n)
+        {
+          char c = letters[frame.i % 2 == 0 ? n : 4-n];
+          bool match = degenerate ? Nuc::matches(word[frame.i], c) : c == word[frame.i];
+          int count = frame.count + (match ? 0 : 1);
 
-      // We store their positions
-      Candidates * ptr = lst;
-      while(ptr != 0)
-      {
-        for(saidx_t k=ptr->low; k<ptr->high; ++k)
-          query.addPosition(_SA[k]);
+          if(count + before > allowed)
+            continue;
 
-        Candidates * prev = ptr;
-        ptr = ptr->next;
-        delete prev;
+          NucFrame child = { 0, 0, frame.i-1, count, MYNOKMER };
+
+          // New low and high indexes
+          int x = Nuc::base(c);
+          if(table && x >= 0)
+          {
+            child.code = (((uint32_t)x) << (2*depth)) + frame.code;
+            child.low = _kmers[2*(kmerOffset(depth+1)+child.code)];
+            child.high = _kmers[2*(kmerOffset(depth+1)+child.code)+1];
+          }
+          else
+          {
+            short ic = Nuc::order(c);
+            child.low = _C[ic] + rank(c, frame.low);
+            child.high = _C[ic] + rank(c, frame.high);
+          }
+
+          if(child.low < child.high)
+            stack.push_back(child);
+        }
       }
     }
   }
   else
   {
-    if(!MISMATCHES)
+    if(!MISMATCHES && !degenerate)
     {
       size_t pos = string::npos;
 
       do {
-        pos = _sequence.find(word,pos+1);
+        pos = _sequence.find(word.data(),pos+1,word.size());
 
         if(pos != string::npos)
           query.addPosition((saidx_t)pos);
@@ -291,26 +199,7 @@ void NucSequence::search(NucQuery & query, const int & mismatches)
       } while(pos != string::npos);
     }
     else
-    {
-      saidx_t seqsize = _sequence.size();
-      if(seqsize >= size)
-      {
-        saidx_t searchedseqsize = seqsize - size;
-
-        // For each position, we check the number of mismatches
-        for(saidx_t pos=0; pos <= searchedseqsize; ++pos)
-        {
-          int miss = 0;
-          for(saidx_t j=0; j<size; ++j)
-            if(word[j] != _sequence[j+pos])
-              ++miss;
-
-          // If miss <= mismatch, we found one more.
-          if(miss <= mismatches)
-            query.addPosition(pos);
-        }
-      }
-    }
+      scanMismatches(query,MISMATCHES ? mismatches : 0);
   }
 }
 
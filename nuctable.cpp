@@ -0,0 +1,93 @@
+#include "nuctable.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+
+void NucTable::load(const string & filename, bool labelled)
+{
+  ifstream input(filename.c_str());
+  if(!input.is_open())
+    throw ios::failure( "Error opening database file !" );
+
+  // We start from an empty table, with "" and "0" in the pool
+  map<string, uint32_t> pool;
+  _arena.clear();
+  _starts.assign(1, 0);
+  _cells.clear();
+  _strings.clear();
+  _strings.push_back("");
+  _strings.push_back("0");
+  pool[""] = 0;
+  pool["0"] = _zero = 1;
+  _ncols = 0;
+
+  string line;
+  string word;
+
+  // If the first line contains labels, we skip it
+  if(labelled)
+    getline(input, line);
+
+  while(getline(input, line))
+  {
+    if(!line.empty() && line[line.size()-1] == '\r')
+      line.resize(line.size()-1);
+
+    // We skip empty lines
+    if(line.empty())
+      continue;
+
+    int row = rows();
+    size_t start = 0;
+    int col = 0;
+
+    do
+    {
+      size_t end = line.find('\t', start);
+      if(end == string::npos)
+        end = line.size();
+
+      if(col == 0)
+      {
+        // The read goes to the arena
+        _arena.append(line, start, end-start);
+        _starts.push_back(_arena.size());
+      }
+      else
+      {
+        // A new column : previous rows are empty in it
+        if(col >= (int)_cells.size())
+        {
+          _cells.resize(col+1);
+          _cells[col].assign(row, 0);
+          _ncols = col+1;
+        }
+
+        // The other cells are interned
+        word.assign(line, start, end-start);
+        map<string, uint32_t>::iterator it = pool.find(word);
+        if(it == pool.end())
+        {
+          it = pool.insert(make_pair(word, (uint32_t)_strings.size())).first;
+          _strings.push_back(word);
+        }
+        _cells[col].push_back(it->second);
+      }
+
+      start = end+1;
+      ++col;
+    } while(start <= line.size());
+
+    // Missing cells are empty
+    for(int c=max(col,1); c<_ncols; ++c)
+      _cells[c].push_back(0);
+  }
+
+  _ncols = max(_ncols, 1);
+  _cells.resize(_ncols);
+
+  input.close();
+}
@@ -0,0 +1,46 @@
+#ifndef NUCTABLE_HPP
+#define NUCTABLE_HPP
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+
+// Database loaded in memory, shared (read-only) by all the threads and passes.
+// The reads (first column) are stored one after the other in an arena, the other
+// columns (counts, names, mapnum...) are interned : each cell is the index of its
+// text in a pool of unique strings, so repeated values are only stored once.
+class NucTable
+{
+  protected:
+    string           _arena;    // Reads, one after the other
+    vector<size_t>   _starts;   // Start of each read in the arena (plus the end)
+    vector<vector<uint32_t> > _cells; // Interned cells, one vector per column (column 0 unused)
+    vector<string>   _strings;  // Pool of unique cell values
+    uint32_t         _zero;     // Index of "0" in the pool
+    int              _ncols;
+
+  public:
+    // Constructor
+    NucTable() : _zero(0), _ncols(0) {}
+
+    // Loads the database file (skipping the first line if it contains the labels)
+    void load(const string & filename, bool labelled);
+
+    // Sizes
+    int rows()    const { return _starts.empty() ? 0 : (int)_starts.size()-1; }
+    int columns() const { return _ncols; }
+
+    // Read of a row (pointer to the arena and size)
+    const char * read(int row)     const { return &_arena[0] + _starts[row]; }
+    size_t       readsize(int row) const { return _starts[row+1] - _starts[row]; }
+
+    // Cell of a row (col > 0), empty if the line was shorter
+    const string & field(int row, int col) const { return _strings[_cells[col][row]]; }
+
+    // Checks if a cell is "0" (read absent from the corresponding library)
+    bool zero(int row, int col) const { return _cells[col][row] == _zero; }
+};
+
+#endif // NUCTABLE_HPP
@@ -0,0 +1,113 @@
+#include "nuctrimmer.hpp"
+#include "nucsequences.hpp"
+using namespace std;
+
+
+NucTrimmer::NucTrimmer(const string & adapter, bool exact) : _adapter(adapter), _exact(exact)
+{
+  for(int c=0; c<256; ++c)
+    _masks[c] = 0;
+
+  for(size_t j=0; j<_adapter.size() && j<64; ++j)
+    _masks[(unsigned char)_adapter[j]] |= 1ULL << j;
+}
+
+
+size_t NucTrimmer::mismatches(const NucView & read, size_t pos) const
+{
+  size_t mm = 0;
+  for(size_t i=5; i<_adapter.size(); ++i)
+    if(pos+i >= read.size() || read[pos+i] != _adapter[i])
+      ++mm;
+  return mm;
+}
+
+
+size_t NucTrimmer::cut(const NucView & read, size_t longest, size_t longestpos, size_t anchorpos) const
+{
+  // (a prefix of 9 characters is checked as an approximate match)
+  if(longest > 0 && longest != 9)
+    return _exact ? longestpos : string::npos;
+
+  if(anchorpos == string::npos)
+    return string::npos;
+
+  size_t size = _adapter.size();
+  if( (float)mismatches(read, anchorpos)/(float)(size-5) < 0.2 )
+    return anchorpos;
+  return string::npos;
+}
+
+
+size_t NucTrimmer::findLong(const NucView & read) const
+{
+  const char * end = read.data()+read.size();
+  const char * adapter = _adapter.data();
+
+  size_t longest = 0;
+  size_t longestpos = string::npos;
+  for(size_t size = _adapter.size(); size >= 8 && longest == 0; --size)
+  {
+    const char * it = search(read.data(), end, adapter, adapter+size);
+    if(it != end)
+    {
+      longest = size;
+      longestpos = it-read.data();
+    }
+  }
+
+  const char * it = search(read.data(), end, adapter, adapter+5);
+  return cut(read, longest, longestpos, it == end ? string::npos : it-read.data());
+}
+
+
+size_t NucTrimmer::find(const NucView & read) const
+{
+  size_t size = _adapter.size();
+  if(size > 64)
+    return findLong(read);
+
+  // We keep the first occurrence of each prefix, found when its bit is set for the first time
+  size_t first[64];
+  uint64_t state = 0;
+  uint64_t seen = 0;
+  uint64_t whole = 1ULL << (size-1);
+
+  for(size_t i=0; i<read.size(); ++i)
+  {
+    state = ((state << 1) | 1) & _masks[(unsigned char)read[i]];
+
+    uint64_t found = state & ~seen;
+    if(found == 0)
+      continue;
+
+    seen |= found;
+    for(; found != 0; found &= found-1)
+    {
+      int j = Nuc::popcount((found & (0-found)) - 1);
+      first[j] = i-j;
+    }
+
+    // The shorter prefixes all occur before the whole adapter
+    if(seen & whole)
+      break;
+  }
+
+  // Longest prefix among the sizes searched (the whole adapter, else 8 characters at least)
+  size_t longest = 0;
+  for(size_t s=size; s>=8 || s==size; --s)
+  {
+    if(seen & (1ULL << (s-1)))
+    {
+      longest = s;
+      break;
+    }
+    if(s == 1)
+      break;
+  }
+
+  size_t anchor = min(size, (size_t)5);
+  size_t anchorpos = (seen & (1ULL << (anchor-1))) ? first[anchor-1] : string::npos;
+
+  return cut(read, longest, longest > 0 ? first[longest-1] : string::npos, anchorpos);
+}
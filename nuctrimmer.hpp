@@ -0,0 +1,39 @@
+#ifndef NUCTRIMMER_HPP
+#define NUCTRIMMER_HPP
+
+#include <string>
+#include <stdint.h>
+#include "nucview.hpp"
+using namespace std;
+
+
+// 3' adapter of the converters, found in one pass over the read. The longest prefix of
+// the adapter (8 characters at least) found in the read gives the cut, else its first
+// 5 characters with less than 20% of mismatches on the rest of the adapter. The prefixes
+// are matched together, bit-parallel (Shift-And) : bit j of the state tells that the
+// first j+1 characters of the adapter end at the current position of the read
+class NucTrimmer
+{
+  protected:
+    string   _adapter;
+    bool     _exact;       // The reads are cut at the longest prefix (else only at the approximate match)
+    uint64_t _masks[256];  // Bit j of a character if it is the character j of the adapter
+
+    // Mismatches of the adapter at pos of the read (from its 6th character, the end of the read counts)
+    size_t mismatches(const NucView & read, size_t pos) const;
+
+    // Cut of the read, from the first occurrences of the prefixes (npos if it is kept)
+    size_t cut(const NucView & read, size_t longest, size_t longestpos, size_t anchorpos) const;
+
+    // Adapters longer than 64 characters, one search per prefix size
+    size_t findLong(const NucView & read) const;
+
+  public:
+    // Constructor (the fasta converter does not cut at the longest prefix)
+    NucTrimmer(const string & adapter, bool exact = true);
+
+    // Position of the adapter in the read (npos if it is not found)
+    size_t find(const NucView & read) const;
+};
+
+#endif // NUCTRIMMER_HPP
@@ -0,0 +1,41 @@
+#ifndef NUCVIEW_HPP
+#define NUCVIEW_HPP
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+
+// Non-owning view of a text (read, name, fragment...) : the characters are
+// kept by their owner (database table, query buffer), nothing is copied
+class NucView
+{
+  protected:
+    const char * _data;
+    size_t       _size;
+
+  public:
+    // Constructors
+    NucView() : _data(""), _size(0) {}
+    NucView(const char * data, size_t size) : _data(data), _size(size) {}
+    NucView(const string & text) : _data(text.data()), _size(text.size()) {}
+
+    // Getters
+    inline const char * data() const { return _data; }
+    inline size_t       size() const { return _size; }
+    inline bool        empty() const { return _size == 0; }
+    inline char   operator[](size_t i) const { return _data[i]; }
+
+    // Part of the text (no copy)
+    inline NucView substr(size_t pos, size_t size) const { return NucView(_data+pos, min(size, _size-pos)); }
+
+    // Copy of the text
+    inline string str() const { return string(_data, _size); }
+
+    // Comparisons
+    inline bool operator==(const NucView & view) const { return _size == view._size && memcmp(_data, view._data, _size) == 0; }
+    inline bool operator!=(const NucView & view) const { return !(*this == view); }
+};
+
+#endif // NUCVIEW_HPP